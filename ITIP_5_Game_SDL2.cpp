@@ -1,6 +1,30 @@
 ﻿#include <iostream>
 #include <string>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <SDL.h>
 #include <SDL_image.h>
@@ -28,9 +52,269 @@ int mouse_y = window_height / 2; // начальная позиция мышки
 
 int speed = 190; // скорость бега мышки за курсором
 int FPS = 60; // кол-во кадров в секунду
+int idle_FPS = 10; // кол-во кадров в секунду, когда окно не в фокусе
+
+bool is_dirty_rect = false; // режим перерисовки только изменившихся областей кадра (ключ --dirty-rect)
+bool is_fog = false; // туман войны: видна только область вокруг мышки, не закрытая стенками (ключ --fog)
+std::string level_filename; // файл уровня с горячей перезагрузкой (ключ --level), пустая строка - встроенный лабиринт
+std::string bundle_filename = "assets.pak"; // пакет заранее сконвертированных ресурсов (ключ --bundle)
+std::string record_filename; // запись партий для воспроизведения (ключ --record)
+std::string replay_filename; // воспроизведение записи в видео без окна (ключ --replay)
+std::string video_filename = "replay.y4m"; // куда пишется видео воспроизведения (ключ --video)
+int sdf_cell_size = 4; // шаг поля расстояний до стенок в пикселях (ключ --sdf-cell), 0 - без поля
 
 /* конец глобальной области */
 
+#pragma region asset_bundle
+/* формат пакета ресурсов: заголовок, таблица записей, данные (каждые выровнены на 64 байта).
+   Картинки хранятся уже декодированными в формате текстур рендера, шрифты - байт в байт */
+const char BUNDLE_MAGIC[8] = { 'M', 'I', 'K', 'I', 'P', 'A', 'K', '1' };
+
+enum BundleEntryType
+{
+	BUNDLE_IMAGE = 0, // пиксели в формате format, строки по pitch байт
+	BUNDLE_RAW = 1 // содержимое файла без изменений (шрифты)
+};
+
+enum BundleEntryFlags
+{
+	BUNDLE_HAS_ALPHA = 1 // в картинке есть прозрачные пиксели - текстуре нужно смешивание
+};
+
+struct BundleHeader
+{
+	char magic[8];
+	Uint32 version;
+	Uint32 count; // кол-во записей
+};
+
+struct BundleEntry
+{
+	char name[64]; // имя исходного файла; у отмасштабированных копий - "имя@ШИРИНАxВЫСОТА"
+	Uint32 type;
+	Uint32 format; // SDL_PIXELFORMAT_*
+	Sint32 width;
+	Sint32 height;
+	Sint32 pitch;
+	Uint32 flags;
+	Uint64 offset; // от начала файла
+	Uint64 size;
+};
+
+// пакет ресурсов, отображенный в память (mmap/MapViewOfFile): данные читаются прямо из страниц файла
+class AssetBundle
+{
+	const Uint8* data = nullptr;
+	size_t size = 0;
+	const BundleEntry* entries = nullptr;
+	Uint32 count = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#endif
+public:
+	AssetBundle() {}
+	~AssetBundle()
+	{
+		close();
+	}
+
+	bool open(const char* filename)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER file_size;
+		GetFileSizeEx(file, &file_size);
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+			data = (const Uint8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = size_t(file_size.QuadPart);
+#else
+		int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0)
+		{
+			size = size_t(info.st_size);
+			void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED)
+				data = (const Uint8*)mapped; // страницы читаются только для тех записей, что понадобятся (см. bytes())
+		}
+		::close(fd); // отображение остается действительным и после закрытия дескриптора
+#endif
+		if (data == nullptr)
+		{
+			std::cout << "Error mapping bundle: " << filename << std::endl;
+			close();
+			return false;
+		}
+
+		/* проверка заголовка и границ всех записей, чтобы дальше читать без проверок */
+		const BundleHeader* header = (const BundleHeader*)data;
+		if (size < sizeof(BundleHeader) || memcmp(header->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0
+			|| header->version != 1 || (size - sizeof(BundleHeader)) / sizeof(BundleEntry) < header->count)
+		{
+			std::cout << "Error bundle header: " << filename << std::endl;
+			close();
+			return false;
+		}
+
+		entries = (const BundleEntry*)(data + sizeof(BundleHeader));
+		count = header->count;
+		for (Uint32 i = 0; i < count; ++i)
+		{
+			const BundleEntry& entry = entries[i];
+			bool is_image_valid = entry.type != BUNDLE_IMAGE
+				|| (entry.width > 0 && entry.height > 0 && entry.pitch >= entry.width * 4
+					&& Uint64(entry.pitch) * entry.height <= entry.size);
+			if (entry.offset > size || entry.size > size - entry.offset || entry.name[sizeof(entry.name) - 1] != 0
+				|| !is_image_valid)
+			{
+				std::cout << "Error bundle entry: " << filename << std::endl;
+				close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data)
+			munmap((void*)data, size);
+#endif
+		data = nullptr;
+		size = 0;
+		entries = nullptr;
+		count = 0;
+	}
+
+	bool is_open() const
+	{
+		return data != nullptr;
+	}
+
+	const BundleEntry* find(const std::string& name) const
+	{
+		for (Uint32 i = 0; i < count; ++i)
+			if (name == entries[i].name)
+				return &entries[i];
+		return nullptr;
+	}
+
+	// картинка, заранее отмасштабированная ровно под width x height, если такая есть в пакете, иначе исходная
+	const BundleEntry* find_image(const std::string& name, int width, int height) const
+	{
+		const BundleEntry* entry = nullptr;
+		if (width > 0 && height > 0)
+			entry = find(name + "@" + std::to_string(width) + "x" + std::to_string(height));
+		if (entry == nullptr)
+			entry = find(name);
+		return (entry != nullptr && entry->type == BUNDLE_IMAGE) ? entry : nullptr;
+	}
+
+	// данные записи; на Linux ядро сразу просят прочитать всю запись целиком, а не по странице на каждый промах
+	const void* bytes(const BundleEntry* entry) const
+	{
+#ifndef _WIN32
+		static const size_t page = size_t(sysconf(_SC_PAGESIZE));
+		size_t begin = size_t(entry->offset) / page * page;
+		madvise((void*)(data + begin), size_t(entry->offset + entry->size) - begin, MADV_WILLNEED);
+#endif
+		return data + entry->offset;
+	}
+};
+
+AssetBundle assets; // пакет ресурсов; если он не открыт, все грузится из отдельных файлов
+
+// текстура из картинки пакета: пиксели уже в формате рендера и передаются в SDL_UpdateTexture прямо из отображенного файла
+SDL_Texture* create_bundle_texture(const BundleEntry* entry)
+{
+	void* pixels = (void*)assets.bytes(entry);
+	SDL_Texture* texture = nullptr;
+
+	SDL_RendererInfo info;
+	bool is_native = false;
+	if (SDL_GetRendererInfo(render, &info) == 0)
+		for (Uint32 i = 0; i < info.num_texture_formats; ++i)
+			is_native = is_native || info.texture_formats[i] == entry->format;
+
+	if (is_native)
+	{
+		texture = SDL_CreateTexture(render, entry->format, SDL_TEXTUREACCESS_STATIC, entry->width, entry->height);
+		if (texture != nullptr && SDL_UpdateTexture(texture, NULL, pixels, entry->pitch) != 0)
+		{
+			SDL_DestroyTexture(texture);
+			texture = nullptr;
+		}
+	}
+
+	if (texture == nullptr) // рендер не принимает этот формат напрямую - пусть SDL сконвертирует
+	{
+		SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels, entry->width, entry->height, 32,
+			entry->pitch, entry->format);
+		if (surface == nullptr)
+			return nullptr;
+		texture = SDL_CreateTextureFromSurface(render, surface);
+		SDL_FreeSurface(surface);
+		if (texture == nullptr)
+			return nullptr;
+	}
+
+	SDL_SetTextureBlendMode(texture, (entry->flags & BUNDLE_HAS_ALPHA) ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE);
+	return texture;
+}
+
+// поверхность ARGB8888 для чтения пикселей на процессоре (маски столкновений); освобождать SDL_FreeSurface
+SDL_Surface* load_surface(const char* filename)
+{
+	SDL_Surface* loaded = nullptr;
+	const BundleEntry* entry = assets.is_open() ? assets.find_image(filename, 0, 0) : nullptr;
+	if (entry != nullptr)
+		loaded = SDL_CreateRGBSurfaceWithFormatFrom((void*)assets.bytes(entry), entry->width, entry->height, 32,
+			entry->pitch, entry->format);
+	else
+		loaded = IMG_Load(filename);
+
+	if (loaded == nullptr)
+	{
+		std::cout << "Error IMG_Load(): " << IMG_GetError() << std::endl;
+		return nullptr;
+	}
+
+	SDL_Surface* surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_FreeSurface(loaded);
+	if (surface == nullptr)
+		std::cout << "Error SDL_ConvertSurfaceFormat(): " << SDL_GetError() << std::endl;
+	return surface;
+}
+
+// шрифт из пакета (читается прямо из отображенной памяти) или из файла
+TTF_Font* open_font(const char* filename, int size)
+{
+	const BundleEntry* entry = assets.is_open() ? assets.find(filename) : nullptr;
+	if (entry != nullptr && entry->type == BUNDLE_RAW)
+		return TTF_OpenFontRW(SDL_RWFromConstMem(assets.bytes(entry), int(entry->size)), 1, size);
+	return TTF_OpenFont(filename, size);
+}
+#pragma endregion asset_bundle
+
 class ObjectTexture // класс для создания текстур
 {
 public:
@@ -48,8 +332,30 @@ public:
 		}
 	}
 
-	SDL_Texture* create_texture(const char* filename) // метод создания текстуры
+	// метод создания текстуры; width x height - размер на экране, под который в пакете ресурсов может быть заранее отмасштабированная копия
+	SDL_Texture* create_texture(const char* filename, int width = 0, int height = 0)
 	{
+		if (texture) // повторная загрузка (например, другой копии фона после изменения размера окна)
+		{
+			SDL_DestroyTexture(texture);
+			texture = nullptr;
+		}
+
+		const BundleEntry* entry = assets.is_open() ? assets.find_image(filename, width, height) : nullptr;
+		if (entry != nullptr)
+		{
+			texture = create_bundle_texture(entry);
+			if (texture == nullptr)
+			{
+				std::cout << "Error create_bundle_texture(): " << SDL_GetError() << std::endl;
+				return nullptr;
+			}
+
+			src = { 0, 0, entry->width, entry->height };
+			dst = { 0, 0, 0, 0 };
+			return texture;
+		}
+
 		SDL_Surface* surface = IMG_Load(filename);
 		if (surface == nullptr)
 		{
@@ -107,7 +413,7 @@ public:
 
 	void load_font(const char* filename, int size) // метод загрузки шрифта по имени файла и задание размера
 	{
-		font = TTF_OpenFont(filename, size);
+		font = open_font(filename, size);
 		if (font == nullptr)
 		{
 			std::cout << "Error open font: " << TTF_GetError() << std::endl;
@@ -132,7 +438,8 @@ public:
 	}
 };
 
-void Init_SDL2(Uint32 flags) // инициализация библиотеки
+// инициализация библиотеки; при target != nullptr окно не создается, а программный рендер рисует в поверхность target
+void Init_SDL2(Uint32 flags, SDL_Surface* target = nullptr)
 {
 	// подключение SDL2
 	if (SDL_Init(flags) != 0)
@@ -158,6 +465,19 @@ void Init_SDL2(Uint32 flags) // инициализация библиотеки
 		exit(1);
 	}
 
+	if (target != nullptr)
+	{
+		render = SDL_CreateSoftwareRenderer(target);
+		if (render == nullptr)
+		{
+			std::cout << "Error SDL_CreateSoftwareRenderer(): " << SDL_GetError() << std::endl;
+			IMG_Quit();
+			SDL_Quit();
+			exit(1);
+		}
+		return;
+	}
+
 	// создание окна
 	window = SDL_CreateWindow("Mouse Miki Game", SDL_WINDOWPOS_CENTERED,
 		SDL_WINDOWPOS_CENTERED, window_width, window_height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
@@ -188,286 +508,2055 @@ float move_mouse(int& mouse_x, int& mouse_y, int& kursor_x, int& kursor_y, int F
 	float y = kursor_y - mouse_y;
 	float len = sqrt(x * x + y * y);
 
-	if (len == 0)
-		len = 0.1;
+	if (len == 0)
+		len = 0.1;
+
+	x /= len;
+	y /= len;
+
+	if (len > 30)
+	{
+		mouse_x += x * speed / FPS;
+		mouse_y += y * speed / FPS;
+	}
+	return len;
+}
+
+// функция отрисовки стенок лабиринта и заполнения координатами четырех массивов для дальнейшего прохода
+// (при is_draw == false массивы только заполняются, без обращения к рендеру)
+int drawing_maze(int* wall_x, int* wall_y, int* wall_w, int* wall_h, int height = window_height, bool is_draw = true)
+{
+	const SDL_Rect walls[] =
+	{
+		{ 90, 80, 10, int(height / 1.4) },
+		{ 90, 80, 200, 10 },
+		{ 170, 0, 10, 80 },
+		{ 390, 80, 775, 10 },
+		{ 1165, 80, 10, 200 }, // 5
+		{ 1165, 340, 10, 300 },
+		{ 1165, 490, 85, 10 },
+		{ 90, 640, 1085, 10 },
+		{ 170, 150, 10, 430 }, // 9
+		{ 170, 150, 300, 10 },
+		{ 570, 150, 520, 10 },
+		{ 1090, 150, 10, 190 }, // 12
+		{ 1090, 400, 10, 180 },
+		{ 170, 580, 930, 10 },
+		{ 90, 400, 80, 10 }, // 15
+		{ 770, 80, 10, 70 },
+		{ 250, 230, 10, 270 },
+		{ 250, 230, 220, 10 }, // 18
+		{ 250, 500, 110, 10 },
+		{ 470, 230, 10, 100 },
+		{ 390, 330, 90, 10 }, // 21
+		{ 390, 330, 10, 90 },
+		{ 390, 420, 500, 10 },
+		{ 740, 230, 10, 190 }, // 24
+		{ 740, 230, 260, 10 },
+		{ 1000, 230, 10, 270 },
+		{ 450, 500, 560, 10 }, // 27
+		{ 700, 500, 10, 80 },
+		{ 830, 310, 170, 10 }
+	};
+
+	int counter = 0;
+	if (is_draw)
+		SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
+
+	for (const SDL_Rect& rect : walls)
+	{
+		if (is_draw)
+			SDL_RenderFillRect(render, &rect);
+		wall_x[counter] = rect.x;
+		wall_y[counter] = rect.y;
+		wall_w[counter] = rect.w;
+		wall_h[counter] = rect.h;
+		counter++;
+	}
+
+	return counter;
+}
+
+// проверка столкновения координат мышки с координатами стенки
+bool check_collision_wall(int mouse_x, int mouse_y,int mouse_w, int mouse_h, int* wall_x, int* wall_y, int* wall_w, int* wall_h, int counter)
+{
+	for (int i = 0; i < counter; ++i)
+	{
+		if ((mouse_x + (mouse_w / 2) < wall_x[i] + wall_w[i]) &&
+			(mouse_x + (mouse_w / 2) > wall_x[i]) &&
+			(mouse_y + (mouse_h / 2) < wall_y[i] + wall_h[i]) &&
+			(mouse_y + (mouse_h / 2) > wall_y[i]))
+		{
+			std::cout << "Mouse!!!: " << mouse_x << ' ' << mouse_y << std::endl;
+			std::cout << "Wall!!!: " << wall_x[counter - 1] << ' ' << wall_h[counter - 1] << std::endl;
+			return true;
+		}
+	}
+	return false;
+}
+
+// проверка столкновения мышки с ключиком (случай выигрыша)
+bool check_collisoin_key(int mouse_x, int mouse_y, int mouse_w, int mouse_h, int key_x, int key_y)
+{
+	if ((mouse_x + (mouse_w / 2) < key_x + 50) && (mouse_x + (mouse_w / 2) > key_x) 
+		&& (mouse_y + (mouse_h / 2) < key_y + 50) && (mouse_y + (mouse_h / 2) > key_y))
+		return true;
+	return false;
+}
+
+#pragma region level
+// стенки встроенного лабиринта из drawing_maze() в виде списка прямоугольников
+std::vector<SDL_Rect> builtin_level(int height)
+{
+	int wall_x[MAX_COUNT]{};
+	int wall_y[MAX_COUNT]{};
+	int wall_w[MAX_COUNT]{};
+	int wall_h[MAX_COUNT]{};
+	int counter = drawing_maze(wall_x, wall_y, wall_w, wall_h, height, false);
+
+	std::vector<SDL_Rect> walls(counter);
+	for (int i = 0; i < counter; ++i)
+		walls[i] = { wall_x[i], wall_y[i], wall_w[i], wall_h[i] };
+	return walls;
+}
+
+// загрузка уровня из текстового файла: по одной стенке "x y w h" на строку, строки с # - комментарии
+bool load_level(const std::string& filename, std::vector<SDL_Rect>& walls)
+{
+	std::ifstream file(filename);
+	if (!file)
+	{
+		std::cout << "Error open level: " << filename << std::endl;
+		return false;
+	}
+
+	std::vector<SDL_Rect> loaded;
+	std::string line;
+	int line_number = 0;
+	while (std::getline(file, line))
+	{
+		line_number++;
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+
+		std::istringstream stream(line);
+		SDL_Rect rect;
+		if (!(stream >> rect.x >> rect.y >> rect.w >> rect.h) || rect.w <= 0 || rect.h <= 0)
+		{
+			std::cout << "Error level " << filename << ':' << line_number << ": " << line << std::endl;
+			return false; // оставляем прежний уровень, пока файл не исправят
+		}
+		loaded.push_back(rect);
+	}
+
+	walls.swap(loaded);
+	return true;
+}
+
+struct LevelDiff // изменения уровня между двумя версиями файла
+{
+	std::vector<SDL_Rect> removed;
+	std::vector<SDL_Rect> added;
+
+	bool empty() const
+	{
+		return removed.empty() && added.empty();
+	}
+};
+
+bool rect_less(const SDL_Rect& a, const SDL_Rect& b)
+{
+	if (a.x != b.x) return a.x < b.x;
+	if (a.y != b.y) return a.y < b.y;
+	if (a.w != b.w) return a.w < b.w;
+	return a.h < b.h;
+}
+
+bool rect_equal(const SDL_Rect& a, const SDL_Rect& b)
+{
+	return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+}
+
+// сравнение двух наборов стенок без учета порядка (сортировка и слияние, O(n log n))
+LevelDiff diff_walls(std::vector<SDL_Rect> old_walls, std::vector<SDL_Rect> new_walls)
+{
+	if (!std::is_sorted(old_walls.begin(), old_walls.end(), rect_less)) // список после apply_diff уже отсортирован
+		std::sort(old_walls.begin(), old_walls.end(), rect_less);
+	std::sort(new_walls.begin(), new_walls.end(), rect_less);
+
+	LevelDiff diff;
+	size_t i = 0;
+	size_t j = 0;
+	while (i < old_walls.size() || j < new_walls.size())
+	{
+		if (j == new_walls.size() || (i < old_walls.size() && rect_less(old_walls[i], new_walls[j])))
+			diff.removed.push_back(old_walls[i++]);
+		else if (i == old_walls.size() || rect_less(new_walls[j], old_walls[i]))
+			diff.added.push_back(new_walls[j++]);
+		else
+		{
+			i++;
+			j++;
+		}
+	}
+	return diff;
+}
+
+// применение изменений к списку стенок для отрисовки. Списки в diff отсортированы (см. diff_walls), поэтому
+// удаление идет одним слиянием с отсортированным списком стенок, а добавленные вливаются вторым слиянием;
+// после первого вызова список остается отсортированным, и правка стоит O(n) вместо O(удаленных * n)
+void apply_diff(std::vector<SDL_Rect>& walls, const LevelDiff& diff)
+{
+	if (!std::is_sorted(walls.begin(), walls.end(), rect_less))
+		std::sort(walls.begin(), walls.end(), rect_less);
+
+	std::vector<SDL_Rect> kept;
+	kept.reserve(walls.size());
+	size_t j = 0;
+	for (const SDL_Rect& rect : walls)
+	{
+		while (j < diff.removed.size() && rect_less(diff.removed[j], rect))
+			++j; // такой стенки в списке нет
+		if (j < diff.removed.size() && rect_equal(diff.removed[j], rect))
+		{
+			++j; // одна удаленная стенка убирает ровно одну копию
+			continue;
+		}
+		kept.push_back(rect);
+	}
+
+	walls.clear();
+	walls.reserve(kept.size() + diff.added.size());
+	std::merge(kept.begin(), kept.end(), diff.added.begin(), diff.added.end(), std::back_inserter(walls), rect_less);
+}
+
+// стенки уровня и равномерная сетка над ними: проверка точки смотрит только стенки из ее клетки,
+// а добавление и удаление стенки трогает только клетки, которые она покрывает
+class WallIndex
+{
+	static const int CELL_SIZE = 64; // размер клетки в пикселях
+	static const int GRID_SIZE = 64; // 64x64 клетки покрывают 4096x4096 пикселей, все дальше попадает в крайние клетки
+
+	std::vector<std::vector<int>> cells; // индексы стенок, задевающих клетку
+
+	static int cell_of(int coord)
+	{
+		if (coord < 0)
+			return 0;
+		return std::min(coord / CELL_SIZE, GRID_SIZE - 1);
+	}
+
+	template <typename Action>
+	void for_cells(const SDL_Rect& rect, Action action)
+	{
+		int x1 = cell_of(rect.x + std::max(rect.w, 1) - 1);
+		int y1 = cell_of(rect.y + std::max(rect.h, 1) - 1);
+		for (int y = cell_of(rect.y); y <= y1; ++y)
+			for (int x = cell_of(rect.x); x <= x1; ++x)
+				action(cells[y * GRID_SIZE + x]);
+	}
+
+	void insert_cells(int index)
+	{
+		for_cells(walls[index], [index](std::vector<int>& cell) { cell.push_back(index); });
+	}
+
+	void erase_cells(int index)
+	{
+		for_cells(walls[index], [index](std::vector<int>& cell)
+			{
+				std::vector<int>::iterator it = std::find(cell.begin(), cell.end(), index);
+				if (it != cell.end())
+				{
+					*it = cell.back();
+					cell.pop_back();
+				}
+			});
+	}
+public:
+	std::vector<SDL_Rect> walls;
+
+	WallIndex() : cells(GRID_SIZE * GRID_SIZE) {}
+
+	void assign(const std::vector<SDL_Rect>& new_walls) // полное построение (при старте партии)
+	{
+		for (std::vector<int>& cell : cells)
+			cell.clear();
+		walls.clear();
+		for (const SDL_Rect& rect : new_walls)
+			add(rect);
+	}
+
+	void add(const SDL_Rect& rect)
+	{
+		walls.push_back(rect);
+		insert_cells(int(walls.size()) - 1);
+	}
+
+	bool remove(const SDL_Rect& rect)
+	{
+		int index = -1;
+		for (int i : cells[cell_of(rect.y) * GRID_SIZE + cell_of(rect.x)]) // стенка обязательно лежит в клетке своего угла
+		{
+			if (rect_equal(walls[i], rect))
+			{
+				index = i;
+				break;
+			}
+		}
+		if (index < 0)
+			return false;
+
+		/* на место удаленной стенки переезжает последняя, чтобы индексы оставались плотными */
+		int last = int(walls.size()) - 1;
+		erase_cells(index);
+		if (index != last)
+		{
+			erase_cells(last);
+			walls[index] = walls[last];
+			insert_cells(index);
+		}
+		walls.pop_back();
+		return true;
+	}
+
+	void apply(const LevelDiff& diff)
+	{
+		for (const SDL_Rect& rect : diff.removed)
+			remove(rect);
+		for (const SDL_Rect& rect : diff.added)
+			add(rect);
+	}
+
+	template <typename Visitor>
+	bool any_near(const SDL_Rect& area, Visitor visit) const // true, если visit(стенка) вернул true для стенки из клеток area
+	{
+		int x1 = cell_of(area.x + std::max(area.w, 1) - 1);
+		int y1 = cell_of(area.y + std::max(area.h, 1) - 1);
+		for (int y = cell_of(area.y); y <= y1; ++y)
+			for (int x = cell_of(area.x); x <= x1; ++x)
+				for (int i : cells[y * GRID_SIZE + x])
+					if (visit(walls[i]))
+						return true;
+		return false;
+	}
+
+	bool check_point(int x, int y) const // то же условие, что в check_collision_wall(), но по одной клетке
+	{
+		for (int i : cells[cell_of(y) * GRID_SIZE + cell_of(x)])
+		{
+			const SDL_Rect& wall = walls[i];
+			if (x < wall.x + wall.w && x > wall.x && y < wall.y + wall.h && y > wall.y)
+				return true;
+		}
+		return false;
+	}
+
+	// расстояние вдоль луча (ox, oy) + t * (dx, dy) до первой стенки, но не больше max_t. Луч идет по клеткам сетки
+	// (алгоритм Amanatides-Woo) и проверяет только стенки из пройденных клеток, останавливаясь, как только
+	// найденное попадание ближе входа в следующую клетку
+	float cast_ray(float ox, float oy, float dx, float dy, float max_t) const
+	{
+		const float INF = 1e30f;
+		int cx = int(floorf(ox / CELL_SIZE));
+		int cy = int(floorf(oy / CELL_SIZE));
+		int step_x = dx > 0 ? 1 : -1;
+		int step_y = dy > 0 ? 1 : -1;
+		float delta_x = dx != 0 ? CELL_SIZE / fabsf(dx) : INF; // t на одну клетку по каждой оси
+		float delta_y = dy != 0 ? CELL_SIZE / fabsf(dy) : INF;
+		float next_x = dx != 0 ? ((cx + (dx > 0 ? 1 : 0)) * float(CELL_SIZE) - ox) / dx : INF; // t до следующей границы клеток
+		float next_y = dy != 0 ? ((cy + (dy > 0 ? 1 : 0)) * float(CELL_SIZE) - oy) / dy : INF;
+
+		float best = max_t;
+		float enter = 0; // t входа в текущую клетку
+		while (enter <= best)
+		{
+			/* за краем сетки стенки лежат в крайних клетках (см. cell_of) */
+			int x = std::max(0, std::min(cx, GRID_SIZE - 1));
+			int y = std::max(0, std::min(cy, GRID_SIZE - 1));
+			for (int i : cells[y * GRID_SIZE + x])
+				best = std::min(best, ray_rect(ox, oy, dx, dy, walls[i]));
+
+			if (next_x < next_y)
+			{
+				enter = next_x;
+				next_x += delta_x;
+				cx += step_x;
+			}
+			else
+			{
+				enter = next_y;
+				next_y += delta_y;
+				cy += step_y;
+			}
+		}
+		return best;
+	}
+
+	// t входа луча в прямоугольник (0, если начало луча внутри) или 1e30, если луч его не задевает
+	static float ray_rect(float ox, float oy, float dx, float dy, const SDL_Rect& rect)
+	{
+		const float INF = 1e30f;
+		float t_min = 0;
+		float t_max = INF;
+		const float origin[2] = { ox, oy };
+		const float direction[2] = { dx, dy };
+		const float low[2] = { float(rect.x), float(rect.y) };
+		const float high[2] = { float(rect.x + rect.w), float(rect.y + rect.h) };
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			if (direction[axis] == 0)
+			{
+				if (origin[axis] < low[axis] || origin[axis] >= high[axis])
+					return INF;
+				continue;
+			}
+
+			float t1 = (low[axis] - origin[axis]) / direction[axis];
+			float t2 = (high[axis] - origin[axis]) / direction[axis];
+			t_min = std::max(t_min, std::min(t1, t2));
+			t_max = std::min(t_max, std::max(t1, t2));
+		}
+		return t_min < t_max ? t_min : INF; // касание края или угла не считается: стенка занимает [x, x + w)
+	}
+};
+
+// очередь изменений уровня без блокировок: пишет только главный поток, читает только поток симуляции
+class LevelDiffQueue
+{
+	static const int CAPACITY = 64;
+
+	LevelDiff* items[CAPACITY] = {};
+	std::atomic<int> head{ 0 }; // следующий элемент для чтения
+	std::atomic<int> tail{ 0 }; // следующее свободное место для записи
+public:
+	bool push(LevelDiff* diff)
+	{
+		int index = tail.load(std::memory_order_relaxed);
+		int next = (index + 1) % CAPACITY;
+		if (next == head.load(std::memory_order_acquire))
+			return false;
+
+		items[index] = diff;
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	LevelDiff* pop()
+	{
+		int index = head.load(std::memory_order_relaxed);
+		if (index == tail.load(std::memory_order_acquire))
+			return nullptr;
+
+		LevelDiff* diff = items[index];
+		head.store((index + 1) % CAPACITY, std::memory_order_release);
+		return diff;
+	}
+
+	bool empty() const
+	{
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+	void clear() // вызывать, только когда поток симуляции не запущен
+	{
+		while (LevelDiff* diff = pop())
+			delete diff;
+	}
+};
+
+// слежение за файлом уровня: inotify на Linux, опрос времени изменения файла на остальных системах
+class LevelWatcher
+{
+	std::string filename;
+#ifdef __linux__
+	int fd = -1;
+	std::string name; // имя файла без каталога: следим за каталогом, т.к. редакторы часто сохраняют файл переименованием
+#else
+	time_t last_modified = 0;
+	Uint32 last_check = 0;
+
+	time_t modified_time() const
+	{
+#ifdef _WIN32
+		struct _stat info;
+		if (_stat(filename.c_str(), &info) != 0)
+			return 0;
+#else
+		struct stat info;
+		if (stat(filename.c_str(), &info) != 0)
+			return 0;
+#endif
+		return info.st_mtime;
+	}
+#endif
+public:
+	LevelWatcher() {}
+	~LevelWatcher()
+	{
+#ifdef __linux__
+		if (fd >= 0)
+			close(fd);
+#endif
+	}
+
+	bool start(const std::string& path)
+	{
+		filename = path;
+#ifdef __linux__
+		size_t slash = path.find_last_of('/');
+		std::string dir = slash == std::string::npos ? "." : path.substr(0, slash == 0 ? 1 : slash);
+		name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			std::cout << "Error inotify: " << strerror(errno) << std::endl;
+			if (fd >= 0)
+				close(fd);
+			fd = -1;
+			return false;
+		}
+#else
+		last_modified = modified_time();
+#endif
+		return true;
+	}
+
+	bool poll() // true, если файл уровня изменился с прошлого вызова (не блокирует)
+	{
+#ifdef __linux__
+		if (fd < 0)
+			return false;
+
+		bool is_changed = false;
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+		{
+			for (char* ptr = buffer; ptr < buffer + length; )
+			{
+				inotify_event* event = (inotify_event*)ptr;
+				if (event->len > 0 && name == event->name)
+					is_changed = true;
+				ptr += sizeof(inotify_event) + event->len;
+			}
+		}
+		return is_changed;
+#else
+		Uint32 now = SDL_GetTicks();
+		if (now - last_check < 500)
+			return false;
+		last_check = now;
+
+		time_t modified = modified_time();
+		if (modified == last_modified)
+			return false;
+		last_modified = modified;
+		return true;
+#endif
+	}
+};
+#pragma endregion level
+
+#pragma region collision_masks
+// маска столкновений: непрозрачные пиксели спрайта в размере его отображения на экране,
+// упакованные по 64 пикселя строки в слово (бит i слова k - столбец k * 64 + i)
+class CollisionMask
+{
+public:
+	int w = 0;
+	int h = 0;
+	int words = 0; // слов на строку
+	std::vector<Uint64> bits;
+
+	// построение по участку src поверхности в формате ARGB8888, растянутому до width x height
+	void build(SDL_Surface* surface, SDL_Rect src, int width, int height, bool is_mirror)
+	{
+		w = width;
+		h = height;
+		words = (width + 63) / 64;
+		bits.assign(size_t(words) * height, 0);
+
+		for (int y = 0; y < height; ++y)
+		{
+			int sy = src.y + y * src.h / height;
+			if (sy < 0 || sy >= surface->h)
+				continue;
+
+			const Uint32* row = (const Uint32*)((const Uint8*)surface->pixels + sy * surface->pitch);
+			for (int x = 0; x < width; ++x)
+			{
+				int sx = src.x + (is_mirror ? width - 1 - x : x) * src.w / width;
+				if (sx < 0 || sx >= surface->w) // кадр может выходить за край листа спрайтов
+					continue;
+
+				if ((row[sx] >> 24) > 127)
+					bits[size_t(y) * words + x / 64] |= Uint64(1) << (x % 64);
+			}
+		}
+	}
+
+	Uint64 row_bits(int y, int x) const // 64 бита строки y начиная со столбца x (вне маски - нули)
+	{
+		if (y < 0 || y >= h || x >= w || x <= -64)
+			return 0;
+
+		int word = x >= 0 ? x / 64 : -((63 - x) / 64);
+		int shift = x - word * 64;
+		const Uint64* row = &bits[size_t(y) * words];
+		Uint64 low = (word >= 0 && word < words) ? row[word] : 0;
+		Uint64 high = (word + 1 >= 0 && word + 1 < words) ? row[word + 1] : 0;
+		return shift == 0 ? low : (low >> shift) | (high << (64 - shift));
+	}
+
+	bool overlaps_rect(int mask_x, int mask_y, const SDL_Rect& rect) const // маска в (mask_x, mask_y) задевает rect
+	{
+		int x0 = std::max(rect.x - mask_x, 0);
+		int x1 = std::min(rect.x + rect.w - mask_x, w); // не включительно
+		int y0 = std::max(rect.y - mask_y, 0);
+		int y1 = std::min(rect.y + rect.h - mask_y, h);
+		if (x0 >= x1 || y0 >= y1)
+			return false;
+
+		int first = x0 / 64;
+		int last = (x1 - 1) / 64;
+		for (int y = y0; y < y1; ++y)
+		{
+			const Uint64* row = &bits[size_t(y) * words];
+			for (int k = first; k <= last; ++k)
+			{
+				Uint64 range = ~Uint64(0);
+				if (k == first)
+					range &= ~Uint64(0) << (x0 % 64);
+				if (k == last)
+					range &= ~Uint64(0) >> (63 - (x1 - 1) % 64);
+				if (row[k] & range)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	bool overlaps_mask(int mask_x, int mask_y, const CollisionMask& other, int other_x, int other_y) const
+	{
+		int dx = other_x - mask_x;
+		int dy = other_y - mask_y;
+		if (dx >= w || dy >= h || dx + other.w <= 0 || dy + other.h <= 0)
+			return false;
+
+		int y0 = std::max(dy, 0);
+		int y1 = std::min(dy + other.h, h);
+		for (int y = y0; y < y1; ++y)
+		{
+			const Uint64* row = &bits[size_t(y) * words];
+			for (int k = 0; k < words; ++k)
+				if (row[k] & other.row_bits(y - dy, k * 64 - dx))
+					return true;
+		}
+		return false;
+	}
+};
+
+struct SpriteMasks // маски всех кадров листа спрайтов, обычные и отраженные по горизонтали
+{
+	std::vector<CollisionMask> frames;
+	std::vector<CollisionMask> mirrored;
+
+	const CollisionMask* get(int frame, bool is_mirror) const
+	{
+		if (frames.empty())
+			return nullptr;
+
+		frame = std::max(0, std::min(frame, int(frames.size()) - 1));
+		return is_mirror ? &mirrored[frame] : &frames[frame];
+	}
+};
+
+// построение масок для count кадров размером frame, идущих в листе слева направо; width x height - размер на экране
+bool load_sprite_masks(const char* filename, SDL_Rect frame, int count, int width, int height, SpriteMasks& masks)
+{
+	SDL_Surface* surface = load_surface(filename);
+	if (surface == nullptr)
+		return false;
+
+	masks.frames.resize(count);
+	masks.mirrored.resize(count);
+	SDL_LockSurface(surface);
+	for (int i = 0; i < count; ++i)
+	{
+		SDL_Rect src = { frame.x + i * frame.w, frame.y, frame.w, frame.h };
+		masks.frames[i].build(surface, src, width, height, false);
+		masks.mirrored[i].build(surface, src, width, height, true);
+	}
+	SDL_UnlockSurface(surface);
+
+	SDL_FreeSurface(surface);
+	return true;
+}
+
+// попиксельная проверка столкновения спрайта с маской mask в (x, y) со стенками рядом с ним
+bool check_collision_mask(const WallIndex& walls, const CollisionMask& mask, int x, int y)
+{
+	SDL_Rect area = { x, y, mask.w, mask.h };
+	return walls.any_near(area, [&](const SDL_Rect& wall) { return mask.overlaps_rect(x, y, wall); });
+}
+#pragma endregion collision_masks
+
+#pragma region distance_field
+// поле расстояний до стенок со знаком, запеченное по сетке с шагом cell пикселей: в каждой клетке хранится
+// расстояние от ее центра до края ближайшей клетки-стенки (внутри стенки - до края ближайшей свободной клетки,
+// со знаком минус), ограниченное по модулю limit(). Благодаря ограничению значение клетки зависит только
+// от стенок не дальше limit(), и после правки уровня пересчитываются лишь окрестности изменившихся стенок
+class DistanceField
+{
+	static const int MAX_DISTANCE = 64; // больше радиуса, о котором спрашивает simulation_step (полудиагональ мышки ~50 px)
+
+	int cell = 0; // шаг сетки в пикселях, 0 - поле не построено
+	int origin_x = 0; // левый верхний угол сетки
+	int origin_y = 0;
+	int cols = 0;
+	int rows = 0;
+	std::vector<float> distance; // cols * rows значений в пикселях
+
+	// одномерное точное преобразование квадратов расстояний (Felzenszwalb & Huttenlocher):
+	// f - 0 в клетках-источниках и INF в остальных, результат записывается в f
+	static void transform_line(float* f, int n, int stride, std::vector<float>& d, std::vector<int>& v, std::vector<float>& z)
+	{
+		const float INF = 1e20f;
+		int k = 0;
+		v[0] = 0;
+		z[0] = -INF;
+		z[1] = INF;
+		for (int q = 1; q < n; ++q)
+		{
+			float s = ((f[q * stride] + float(q) * q) - (f[v[k] * stride] + float(v[k]) * v[k])) / (2.0f * q - 2.0f * v[k]);
+			while (s <= z[k])
+			{
+				k--;
+				s = ((f[q * stride] + float(q) * q) - (f[v[k] * stride] + float(v[k]) * v[k])) / (2.0f * q - 2.0f * v[k]);
+			}
+			k++;
+			v[k] = q;
+			z[k] = s;
+			z[k + 1] = INF;
+		}
+
+		k = 0;
+		for (int q = 0; q < n; ++q)
+		{
+			while (z[k + 1] < q)
+				k++;
+			d[q] = float(q - v[k]) * (q - v[k]) + f[v[k] * stride];
+		}
+		for (int q = 0; q < n; ++q)
+			f[q * stride] = d[q];
+	}
+
+	// квадраты расстояний (в клетках) от каждой клетки окна width x height до ближайшей клетки с is_source == true
+	static void transform(const std::vector<bool>& is_source, int width, int height, std::vector<float>& result)
+	{
+		result.resize(size_t(width) * height);
+		for (size_t i = 0; i < result.size(); ++i)
+			result[i] = is_source[i] ? 0.0f : 1e20f;
+
+		int n = std::max(width, height);
+		std::vector<float> d(n);
+		std::vector<int> v(n);
+		std::vector<float> z(n + 1);
+		for (int x = 0; x < width; ++x) // сначала по столбцам, затем по строкам
+			transform_line(&result[x], height, width, d, v, z);
+		for (int y = 0; y < height; ++y)
+			transform_line(&result[size_t(y) * width], width, 1, d, v, z);
+	}
+
+	int limit() const // предел хранимых расстояний; запас в две клетки покрывает поправки в min_distance()
+	{
+		return MAX_DISTANCE + 2 * cell;
+	}
+
+	int margin() const // на сколько клеток дальше пересчитываемых нужно видеть стенки
+	{
+		return limit() / cell + 2;
+	}
+
+	// пересчет клеток [c0, c1) x [r0, r1) по стенкам walls, которые должны включать все стенки
+	// не дальше margin() клеток от этого прямоугольника
+	void bake_window(int c0, int r0, int c1, int r1, const std::vector<SDL_Rect>& walls)
+	{
+		int m = margin();
+		int sc0 = std::max(0, c0 - m);
+		int sr0 = std::max(0, r0 - m);
+		int sc1 = std::min(cols, c1 + m);
+		int sr1 = std::min(rows, r1 + m);
+		int width = sc1 - sc0;
+		int height = sr1 - sr0;
+		if (width <= 0 || height <= 0)
+			return;
+
+		std::vector<bool> is_wall(size_t(width) * height, false);
+		for (const SDL_Rect& wall : walls)
+		{
+			if (wall.w <= 0 || wall.h <= 0)
+				continue;
+
+			int wc0 = std::max((wall.x - origin_x) / cell, sc0);
+			int wr0 = std::max((wall.y - origin_y) / cell, sr0);
+			int wc1 = std::min((wall.x + wall.w - 1 - origin_x) / cell, sc1 - 1);
+			int wr1 = std::min((wall.y + wall.h - 1 - origin_y) / cell, sr1 - 1);
+			for (int r = wr0; r <= wr1; ++r)
+				for (int c = wc0; c <= wc1; ++c)
+					is_wall[size_t(r - sr0) * width + (c - sc0)] = true;
+		}
+
+		std::vector<float> outside;
+		std::vector<float> inside;
+		transform(is_wall, width, height, outside);
+		is_wall.flip();
+		transform(is_wall, width, height, inside);
+
+		/* от центра до центра ближайшей клетки минус полклетки - расстояние до ее края: у стенок по сетке ноль ровно на границе */
+		const float max_value = float(limit());
+		for (int r = r0; r < r1; ++r)
+			for (int c = c0; c < c1; ++c)
+			{
+				size_t i = size_t(r - sr0) * width + (c - sc0);
+				float value = outside[i] > 0 ? (sqrtf(outside[i]) - 0.5f) * cell : -(sqrtf(inside[i]) - 0.5f) * cell;
+				distance[size_t(r) * cols + c] = std::max(-max_value, std::min(value, max_value));
+			}
+	}
+
+	float sample(int col, int row) const
+	{
+		col = std::max(0, std::min(col, cols - 1));
+		row = std::max(0, std::min(row, rows - 1));
+		return distance[size_t(row) * cols + col];
+	}
+
+	bool contains(const SDL_Rect& wall) const // лежит ли стенка внутри сетки вместе с полосой limit() вокруг нее
+	{
+		int border = margin() * cell;
+		return wall.x >= origin_x + border && wall.y >= origin_y + border
+			&& wall.x + wall.w <= origin_x + cols * cell - border && wall.y + wall.h <= origin_y + rows * cell - border;
+	}
+public:
+	bool is_baked() const
+	{
+		return cell > 0;
+	}
+
+	int cell_size() const
+	{
+		return cell;
+	}
+
+	// построение поля по стенкам уровня; клетка считается стенкой, если стенка задевает ее хотя бы частично
+	void bake(const std::vector<SDL_Rect>& walls, int cell_size)
+	{
+		cell = 0;
+		distance.clear();
+		if (cell_size <= 0 || walls.empty())
+			return;
+
+		/* сетка покрывает все стенки и левый верхний угол окна, где стоит мышка в начале партии, с полосой limit()
+		   вокруг, поэтому за сеткой до стенок заведомо дальше limit() */
+		int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+		for (const SDL_Rect& wall : walls)
+		{
+			x0 = std::min(x0, wall.x);
+			y0 = std::min(y0, wall.y);
+			x1 = std::max(x1, wall.x + wall.w);
+			y1 = std::max(y1, wall.y + wall.h);
+		}
+		cell = cell_size;
+		int m = margin();
+		origin_x = x0 - m * cell;
+		origin_y = y0 - m * cell;
+		cols = (x1 - origin_x) / cell + 1 + m;
+		rows = (y1 - origin_y) / cell + 1 + m;
+
+		distance.assign(size_t(cols) * rows, float(limit()));
+		bake_window(0, 0, cols, rows, walls);
+	}
+
+	// правка поля после изменения уровня (walls - уже с примененным diff): пересчитываются только клетки
+	// не дальше MAX_DISTANCE от удаленных и добавленных стенок. Если стенка вышла за сетку или правка
+	// задевает больше половины сетки, поле строится заново целиком
+	void update(const WallIndex& walls, const LevelDiff& diff, int cell_size)
+	{
+		bool is_full = !is_baked() || cell != cell_size;
+		size_t window_cells = 0;
+		int m = margin();
+		for (int pass = 0; pass < 2 && !is_full; ++pass)
+		{
+			for (const SDL_Rect& rect : pass == 0 ? diff.removed : diff.added)
+			{
+				if (pass == 1 && !contains(rect))
+				{
+					is_full = true;
+					break;
+				}
+				window_cells += size_t(rect.w / cell + 1 + 4 * m) * (rect.h / cell + 1 + 4 * m);
+			}
+		}
+		if (is_full || window_cells > distance.size() / 2)
+		{
+			bake(walls.walls, cell_size);
+			return;
+		}
+
+		std::vector<SDL_Rect> nearby;
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			for (const SDL_Rect& rect : pass == 0 ? diff.removed : diff.added)
+			{
+				/* меняются клетки не дальше m от стенки, а для них нужны стенки еще на m дальше */
+				int c0 = std::max(0, (rect.x - origin_x) / cell - m);
+				int r0 = std::max(0, (rect.y - origin_y) / cell - m);
+				int c1 = std::min(cols, (rect.x + rect.w - origin_x) / cell + 1 + m);
+				int r1 = std::min(rows, (rect.y + rect.h - origin_y) / cell + 1 + m);
+
+				SDL_Rect source = { origin_x + (c0 - m) * cell, origin_y + (r0 - m) * cell,
+					(c1 - c0 + 2 * m) * cell, (r1 - r0 + 2 * m) * cell };
+				nearby.clear();
+				walls.any_near(source, [&](const SDL_Rect& wall)
+					{
+						nearby.push_back(wall);
+						return false;
+					});
+				bake_window(c0, r0, c1, r1, nearby);
+			}
+		}
+	}
+
+	// расстояние до ближайшей стенки со знаком (билинейная интерполяция по центрам клеток; вне сетки - limit()).
+	// Клетка считается стенкой, даже если стенка задевает ее краем, поэтому ошибка - до полутора клеток,
+	// а щели уже клетки поле не видит; расстояния дальше limit() обрезаются
+	float get_distance(float x, float y) const
+	{
+		float fx = (x - origin_x) / cell - 0.5f;
+		float fy = (y - origin_y) / cell - 0.5f;
+		int col = int(floorf(fx));
+		int row = int(floorf(fy));
+		float tx = std::max(0.0f, std::min(fx - col, 1.0f));
+		float ty = std::max(0.0f, std::min(fy - row, 1.0f));
+
+		float top = sample(col, row) + (sample(col + 1, row) - sample(col, row)) * tx;
+		float bottom = sample(col, row + 1) + (sample(col + 1, row + 1) - sample(col, row + 1)) * tx;
+		return top + (bottom - top) * ty;
+	}
+
+	// направление от ближайшей стенки (не нормированное, нулевое дальше limit()); вдоль стенки можно скользить,
+	// убрав из движения составляющую, направленную против градиента
+	void gradient(float x, float y, float& gx, float& gy) const
+	{
+		float h = float(cell);
+		gx = (get_distance(x + h, y) - get_distance(x - h, y)) / (2 * h);
+		gy = (get_distance(x, y + h) - get_distance(x, y - h)) / (2 * h);
+	}
+
+	// нижняя оценка настоящего расстояния до стенок: клетка стенки может быть задета лишь краем
+	// (до центра ближайшей клетки-стенки - значение клетки плюс полклетки, минус половина диагонали),
+	// а точка отстоит от центра своей клетки (минус это расстояние)
+	float min_distance(float x, float y) const
+	{
+		int col = std::max(0, std::min(int(floorf((x - origin_x) / cell)), cols - 1));
+		int row = std::max(0, std::min(int(floorf((y - origin_y) / cell)), rows - 1));
+		float dx = x - (origin_x + (col + 0.5f) * cell);
+		float dy = y - (origin_y + (row + 0.5f) * cell);
+		return distance[size_t(row) * cols + col] - 0.2072f * cell - sqrtf(dx * dx + dy * dy); // вне сетки - до центра крайней клетки
+	}
+
+	// может ли круг радиуса r с центром (x, y) задевать стенку; false - гарантированно не задевает.
+	// Для r больше MAX_DISTANCE ответ всегда true
+	bool touches_circle(float x, float y, float r) const
+	{
+		return !is_baked() || min_distance(x, y) <= r;
+	}
+};
+#pragma endregion distance_field
+
+#pragma region replay
+// запись партий для последующего воспроизведения: на каждый шаг симуляции - ввод, с которым он сделан.
+// Формат текстовый: строка "round w h mouse_x mouse_y frame frame_x" открывает партию,
+// за ней строка "walls" и строки "= x y w h" - все стенки, с которыми партия началась (чтобы воспроизведение
+// не зависело от файла уровня на диске), затем строки "t x y click" - время шага в мс от начала партии,
+// курсор и зажата ли кнопка. Изменение стенок во время партии (перезагрузка уровня, изменение размера окна) записывается перед шагом,
+// который его уже учел: строка "level", за ней строки "- x y w h" и "+ x y w h" - удаленные и добавленные стенки
+struct ReplayStep
+{
+	Uint32 time = 0;
+	int kursor_x = 0;
+	int kursor_y = 0;
+	bool is_click = false;
+	std::vector<LevelDiff> levels; // изменения стенок, примененные перед этим шагом (по порядку)
+};
+
+struct ReplayRound
+{
+	int width = 0; // размер окна в начале партии
+	int height = 0;
+	int mouse_x = 0; // начальное положение мышки и кадр анимации
+	int mouse_y = 0;
+	int frame = 0;
+	int frame_x = 0;
+	bool is_walls_recorded = false; // в записях до v3 стенок нет - они строятся заново по текущему уровню
+	std::vector<SDL_Rect> walls; // стенки в начале партии
+	std::vector<ReplayStep> steps;
+};
+
+class ReplayRecorder // пишет главный поток (начало партии) и поток симуляции (шаги), но никогда одновременно
+{
+	std::ofstream file;
+	Uint32 round_start = 0;
+public:
+	bool open(const std::string& filename)
+	{
+		file.open(filename);
+		if (!file.is_open())
+		{
+			std::cout << "Error open replay file: " << filename << std::endl;
+			return false;
+		}
+		file << "# mouse replay v3" << std::endl;
+		return true;
+	}
+
+	bool is_open() const
+	{
+		return file.is_open();
+	}
+
+	void start_round(Uint32 start_time, const ReplayRound& round) // вызывать до запуска потока симуляции
+	{
+		round_start = start_time;
+		file << "round " << round.width << ' ' << round.height << ' ' << round.mouse_x << ' ' << round.mouse_y
+			<< ' ' << round.frame << ' ' << round.frame_x << '\n';
+		file << "walls\n";
+		for (const SDL_Rect& rect : round.walls)
+			file << "= " << rect.x << ' ' << rect.y << ' ' << rect.w << ' ' << rect.h << '\n';
+	}
+
+	void add_level_diff(const LevelDiff& diff) // вызывает поток симуляции, применив diff к своим стенкам
+	{
+		file << "level\n";
+		for (const SDL_Rect& rect : diff.removed)
+			file << "- " << rect.x << ' ' << rect.y << ' ' << rect.w << ' ' << rect.h << '\n';
+		for (const SDL_Rect& rect : diff.added)
+			file << "+ " << rect.x << ' ' << rect.y << ' ' << rect.w << ' ' << rect.h << '\n';
+	}
+
+	void add_step(int kursor_x, int kursor_y, bool is_click)
+	{
+		file << SDL_GetTicks() - round_start << ' ' << kursor_x << ' ' << kursor_y << ' ' << int(is_click) << '\n';
+	}
+
+	void end_round() // вызывать после остановки потока симуляции
+	{
+		file.flush();
+	}
+};
+
+bool load_replay(const std::string& filename, std::vector<ReplayRound>& rounds)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		std::cout << "Error open replay file: " << filename << std::endl;
+		return false;
+	}
+
+	rounds.clear();
+	std::vector<LevelDiff> levels; // изменения стенок, ждущие своего шага
+	std::string line;
+	int line_number = 0;
+	while (std::getline(file, line))
+	{
+		line_number++;
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream stream(line);
+		if (line.compare(0, 6, "round ") == 0)
+		{
+			std::string word;
+			ReplayRound round;
+			if (stream >> word >> round.width >> round.height >> round.mouse_x >> round.mouse_y >> round.frame >> round.frame_x
+				&& round.width > 0 && round.height > 0)
+			{
+				rounds.push_back(round);
+				levels.clear();
+				continue;
+			}
+		}
+		else if (line == "walls")
+		{
+			if (!rounds.empty() && rounds.back().steps.empty())
+			{
+				rounds.back().is_walls_recorded = true;
+				continue;
+			}
+		}
+		else if (line[0] == '=')
+		{
+			char sign = 0;
+			SDL_Rect rect;
+			if (stream >> sign >> rect.x >> rect.y >> rect.w >> rect.h && !rounds.empty()
+				&& rounds.back().is_walls_recorded && rounds.back().steps.empty())
+			{
+				rounds.back().walls.push_back(rect);
+				continue;
+			}
+		}
+		else if (line == "level")
+		{
+			if (!rounds.empty())
+			{
+				levels.push_back(LevelDiff());
+				continue;
+			}
+		}
+		else if (line[0] == '-' || line[0] == '+')
+		{
+			char sign = 0;
+			SDL_Rect rect;
+			if (stream >> sign >> rect.x >> rect.y >> rect.w >> rect.h && !levels.empty())
+			{
+				(sign == '-' ? levels.back().removed : levels.back().added).push_back(rect);
+				continue;
+			}
+		}
+		else
+		{
+			ReplayStep step;
+			int is_click = 0;
+			if (stream >> step.time >> step.kursor_x >> step.kursor_y >> is_click && !rounds.empty())
+			{
+				step.is_click = is_click != 0;
+				for (LevelDiff& level : levels) // apply_diff() ждет отсортированные списки, как их строит diff_walls()
+				{
+					std::sort(level.removed.begin(), level.removed.end(), rect_less);
+					std::sort(level.added.begin(), level.added.end(), rect_less);
+				}
+				step.levels.swap(levels);
+				rounds.back().steps.push_back(std::move(step));
+				continue;
+			}
+		}
+
+		std::cout << "Error replay file " << filename << " line " << line_number << ": " << line << std::endl;
+		return false;
+	}
+	return !rounds.empty();
+}
+
+// поток кадров в формате Y4M (YUV 4:2:0, полный диапазон BT.601). Перевод ARGB -> YUV делят по полосам строк
+// рабочие потоки, причем кадр конвертируется, пока главный поток рисует и читает из рендера следующий
+class VideoWriter
+{
+	std::ofstream file;
+	int width = 0;
+	int height = 0;
+	int frames = 0;
+
+	std::vector<Uint32> pixels[2]; // кадры ARGB8888: в один читается рендер, второй в это время конвертируется
+	int current = 0;
+	std::vector<Uint8> yuv; // плоскости Y, U, V конвертируемого кадра
+	bool is_pending = false; // кадр отдан рабочим потокам и еще не записан
+
+	std::vector<std::thread> workers;
+	std::vector<SDL_sem*> starts; // у каждого рабочего потока свой семафор запуска
+	SDL_sem* done = nullptr; // каждый поток отмечается в нем по окончании своей полосы
+	std::atomic<bool> is_running{ false };
+	const Uint32* source = nullptr;
+
+	// строки [y0, y1) (y0 четное); цветность считается по среднему квадрата 2x2
+	void convert_rows(int y0, int y1)
+	{
+		int chroma_w = (width + 1) / 2;
+		Uint8* plane_y = yuv.data();
+		Uint8* plane_u = plane_y + size_t(width) * height;
+		Uint8* plane_v = plane_u + size_t(chroma_w) * ((height + 1) / 2);
+
+		for (int y = y0; y < y1; y += 2)
+		{
+			const Uint32* row0 = source + size_t(y) * width;
+			const Uint32* row1 = y + 1 < height ? row0 + width : row0;
+			Uint8* out_y0 = plane_y + size_t(y) * width;
+			Uint8* out_y1 = y + 1 < height ? out_y0 + width : out_y0;
+			Uint8* out_u = plane_u + size_t(y / 2) * chroma_w;
+			Uint8* out_v = plane_v + size_t(y / 2) * chroma_w;
+
+			for (int x = 0; x < width; x += 2)
+			{
+				int x1 = x + 1 < width ? x + 1 : x;
+				Uint32 quad[4] = { row0[x], row0[x1], row1[x], row1[x1] };
+				int sum_r = 0, sum_g = 0, sum_b = 0;
+				for (int i = 0; i < 4; ++i)
+				{
+					int r = (quad[i] >> 16) & 0xFF;
+					int g = (quad[i] >> 8) & 0xFF;
+					int b = quad[i] & 0xFF;
+					Uint8 luma = Uint8((77 * r + 150 * g + 29 * b + 128) >> 8);
+					(i < 2 ? out_y0 : out_y1)[i % 2 == 0 ? x : x1] = luma;
+					sum_r += r;
+					sum_g += g;
+					sum_b += b;
+				}
+				out_u[x / 2] = Uint8(std::min(255, ((-43 * sum_r - 85 * sum_g + 128 * sum_b + 512) >> 10) + 128));
+				out_v[x / 2] = Uint8(std::min(255, ((128 * sum_r - 107 * sum_g - 21 * sum_b + 512) >> 10) + 128));
+			}
+		}
+	}
+
+	void worker(int index)
+	{
+		int bands = int(workers.size());
+		int pairs = (height + 1) / 2;
+		int y0 = 2 * (pairs * index / bands);
+		int y1 = std::min(height, 2 * (pairs * (index + 1) / bands));
+		while (true)
+		{
+			SDL_SemWait(starts[index]);
+			if (!is_running.load())
+				return;
+
+			convert_rows(y0, y1);
+			SDL_SemPost(done);
+		}
+	}
+
+	void finish_frame() // дождаться конвертации отданного кадра и записать его
+	{
+		if (!is_pending)
+			return;
+
+		for (size_t i = 0; i < workers.size(); ++i)
+			SDL_SemWait(done);
+		file << "FRAME\n";
+		file.write((const char*)yuv.data(), yuv.size());
+		frames++;
+		is_pending = false;
+	}
+public:
+	~VideoWriter()
+	{
+		close();
+	}
+
+	bool open(const std::string& filename, int w, int h, int fps)
+	{
+		file.open(filename, std::ios::binary);
+		if (!file.is_open())
+		{
+			std::cout << "Error open video file: " << filename << std::endl;
+			return false;
+		}
+		file << "YUV4MPEG2 W" << w << " H" << h << " F" << fps << ":1 Ip A1:1 C420jpeg\n";
+
+		width = w;
+		height = h;
+		frames = 0;
+		pixels[0].resize(size_t(w) * h);
+		pixels[1].resize(size_t(w) * h);
+		yuv.resize(size_t(w) * h + 2 * size_t((w + 1) / 2) * ((h + 1) / 2));
+
+		int count = std::max(1, std::min(int(std::thread::hardware_concurrency()), (h + 1) / 2));
+		done = SDL_CreateSemaphore(0);
+		is_running.store(true);
+		starts.resize(count);
+		for (SDL_sem*& start : starts)
+			start = SDL_CreateSemaphore(0);
+		workers.resize(count);
+		for (int i = 0; i < count; ++i)
+			workers[i] = std::thread(&VideoWriter::worker, this, i);
+		return true;
+	}
+
+	void close()
+	{
+		if (!is_running.load())
+			return;
+
+		finish_frame();
+		is_running.store(false);
+		for (SDL_sem* start : starts)
+			SDL_SemPost(start);
+		for (std::thread& thread : workers)
+			thread.join();
+		for (SDL_sem* start : starts)
+			SDL_DestroySemaphore(start);
+		SDL_DestroySemaphore(done);
+		workers.clear();
+		starts.clear();
+		file.close();
+	}
+
+	Uint32* frame_buffer() // сюда читается следующий кадр (ARGB8888, width * height пикселей)
+	{
+		return pixels[current].data();
+	}
+
+	void submit() // отдать заполненный кадр на конвертацию; предыдущий к этому моменту дописывается в файл
+	{
+		finish_frame();
+		source = pixels[current].data();
+		is_pending = true;
+		for (SDL_sem* start : starts)
+			SDL_SemPost(start);
+		current ^= 1;
+	}
+
+	int frame_count() const
+	{
+		return frames + (is_pending ? 1 : 0);
+	}
+};
+#pragma endregion replay
+
+#pragma region simulation_pipeline
+enum GameState // состояние партии, которое публикует поток симуляции
+{
+	STATE_PLAYING = 0,
+	STATE_DEAD = 1,
+	STATE_VICTORY = 2
+};
+
+struct GameSnapshot // неизменяемый снимок мира, передаваемый из потока симуляции в поток отрисовки
+{
+	int mouse_x = 0;
+	int mouse_y = 0;
+	int frame_x = 0; // смещение текущего кадра анимации в спрайте мышки
+	bool mirror = false; // зеркальный рендер мышки при беге влево
+	int state = STATE_PLAYING;
+	Uint32 sequence = 0; // номер шага симуляции, на котором сделан снимок
+	Uint32 input_time = 0; // метка времени события мыши, последним изменившего кадр (для замера задержки)
+};
+
+bool same_picture(const GameSnapshot& a, const GameSnapshot& b) // снимки дают одинаковый кадр на экране
+{
+	return a.mouse_x == b.mouse_x && a.mouse_y == b.mouse_y && a.frame_x == b.frame_x
+		&& a.mirror == b.mirror && a.state == b.state;
+}
+
+// тройной буфер без блокировок: писатель и читатель работают каждый со своим буфером,
+// а третий (средний) передается между ними атомарным обменом индекса
+template <typename T>
+class TripleBuffer
+{
+	static const int FRESH_BIT = 4; // флаг "в среднем буфере лежит непрочитанный снимок"
+
+	T buffers[3];
+	std::atomic<int> middle{ 2 };
+	int back = 0; // буфер писателя (поток симуляции)
+	int front = 1; // буфер читателя (главный поток)
+public:
+	void reset(const T& value) // вызывать, только когда поток симуляции не запущен
+	{
+		for (T& buffer : buffers)
+			buffer = value;
+		middle.store(2);
+		back = 0;
+		front = 1;
+	}
+
+	T& write_buffer()
+	{
+		return buffers[back];
+	}
+
+	void publish() // отдать заполненный буфер читателю и забрать себе свободный
+	{
+		back = middle.exchange(back | FRESH_BIT, std::memory_order_acq_rel) & 3;
+	}
+
+	bool update() // забрать самый свежий снимок, если он появился (true)
+	{
+		if ((middle.load(std::memory_order_relaxed) & FRESH_BIT) == 0)
+			return false;
+
+		front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+		return true;
+	}
+
+	const T& read_buffer() const
+	{
+		return buffers[front];
+	}
+};
+
+struct SimulationInput // ввод, который главный поток передает потоку симуляции
+{
+	std::atomic<Uint64> kursor{ 0 }; // упакованные координаты курсора и метка времени события (см. pack_kursor)
+	std::atomic<bool> is_click{ false }; // зажата ли левая кнопка мыши
+	LevelDiffQueue level_diffs; // изменения стенок после перезагрузки уровня или изменения размера окна
+	std::atomic<bool> is_running{ false }; // флаг работы потока симуляции
+	ReplayRecorder* recorder = nullptr; // запись шагов партии (ключ --record)
+
+	/* простой: симуляция спит на семафоре, пока ввод не изменится, а главный поток не рисует одинаковые кадры */
+	SDL_sem* wakeup = nullptr; // будит поток симуляции
+	std::atomic<bool> is_simulation_idle{ false }; // поток симуляции ждет на wakeup
+	std::atomic<bool> is_main_waiting{ false }; // главный поток ждет событий в видимом окне - о новом кадре нужно сообщить SDL_USEREVENT
+
+	void wake_simulation()
+	{
+		if (is_simulation_idle.load())
+			SDL_SemPost(wakeup);
+	}
+};
+
+// x и y по 16 бит плюс 32 бита метки времени, чтобы поток симуляции читал их одной атомарной операцией
+Uint64 pack_kursor(int x, int y, Uint32 timestamp)
+{
+	return (Uint64(Uint16(x)) << 48) | (Uint64(Uint16(y)) << 32) | timestamp;
+}
+
+void unpack_kursor(Uint64 kursor, int& x, int& y, Uint32& timestamp)
+{
+	x = Sint16(kursor >> 48);
+	y = Sint16((kursor >> 32) & 0xFFFF);
+	timestamp = Uint32(kursor & 0xFFFFFFFF);
+}
+
+// фильтр событий: движения мыши не попадают в очередь, а сразу схлопываются в последнее положение курсора.
+// Вызывается внутри SDL_PumpEvents/SDL_WaitEventTimeout, поэтому курсор обновляется и пока главный поток ждет кадр
+int motion_event_filter(void* userdata, SDL_Event* event)
+{
+	if (event->type != SDL_MOUSEMOTION)
+		return 1;
+
+	SimulationInput* input = (SimulationInput*)userdata;
+	input->kursor.store(pack_kursor(event->motion.x, event->motion.y, event->motion.timestamp));
+	input->wake_simulation();
+	return 0;
+}
+
+class LatencyStats // сбор задержек "событие мыши -> SDL_RenderPresent" и подсчет перцентилей
+{
+	std::vector<Uint32> samples; // задержки в миллисекундах
+	Uint32 last_input_time = 0; // событие, для которого задержка уже учтена
+public:
+	LatencyStats()
+	{
+		samples.reserve(1 << 16);
+	}
+
+	void on_present(Uint32 input_time) // вызывать сразу после SDL_RenderPresent
+	{
+		if (input_time == 0 || input_time == last_input_time)
+			return;
+
+		last_input_time = input_time;
+		samples.push_back(SDL_GetTicks() - input_time);
+	}
+
+	Uint32 percentile(int p)
+	{
+		if (samples.empty())
+			return 0;
+
+		size_t n = (samples.size() - 1) * p / 100;
+		std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+		return samples[n];
+	}
+
+	void report() // вывод p50/p99 за партию и сброс статистики
+	{
+		if (!samples.empty())
+		{
+			Uint32 p50 = percentile(50);
+			Uint32 p99 = percentile(99);
+			std::cout << "Input latency: p50 = " << p50 << " ms, p99 = " << p99 << " ms ("
+				<< samples.size() << " samples)" << std::endl;
+		}
+		samples.clear();
+		last_input_time = 0;
+	}
+};
+
+struct SimulationWorld // данные уровня, которыми владеет поток симуляции
+{
+	WallIndex walls; // стенки лабиринта с сеткой для проверки столкновений
+	DistanceField field; // поле расстояний до стенок: пока мышка далеко от них, точная проверка не нужна
+
+	int mouse_w = 75; // размеры мышки на экране
+	int mouse_h = 65;
+	int frame_w = 0; // ширина одного кадра в спрайте мышки
+
+	int key_x = 0; // положение ключика
+	int key_y = 0;
+
+	const SpriteMasks* mouse_masks = nullptr; // маски кадров мышки и ключика (неизменяемые после загрузки);
+	const SpriteMasks* key_masks = nullptr; // если их нет, проверяется только центр мышки, как раньше
+};
+
+// один шаг игровой логики: движение мышки за курсором, анимация и проверка столкновений
+void simulation_step(GameSnapshot& snapshot, SimulationWorld& world, int kursor_x, int kursor_y, bool is_click)
+{
+	snapshot.mirror = mouse_x > kursor_x;
+
+	/* обработка движений мышки (персонажа) при нажатии левой кнопки мыши */
+	if (is_click)
+	{
+		float len = move_mouse(mouse_x, mouse_y, kursor_x, kursor_y, FPS, speed);
+
+		if (len > 30) // оставляем расстояние от курсора, чтобы не прилипала к нему
+		{
+			frame = (frame + 1) % count_frame;
+			snapshot.frame_x = frame * world.frame_w;
+		}
+		else
+		{
+			snapshot.frame_x = world.frame_w * 2;
+		}
+	}
+
+	snapshot.mouse_x = mouse_x;
+	snapshot.mouse_y = mouse_y;
+
+	/* проверка на столкновение со стенкой лабиринта и с ключем (финиш) */
+	const CollisionMask* mouse_mask = world.mouse_masks ? world.mouse_masks->get(snapshot.frame_x / world.frame_w, snapshot.mirror) : nullptr;
+	const CollisionMask* key_mask = world.key_masks ? world.key_masks->get(0, false) : nullptr;
+	bool is_masks = mouse_mask != nullptr && key_mask != nullptr;
+
+	/* одна выборка из поля расстояний: круг вокруг спрайта (или центр мышки без масок) далеко от стенок - столкновения нет */
+	int center_x = mouse_x + (world.mouse_w / 2);
+	int center_y = mouse_y + (world.mouse_h / 2);
+	float radius = is_masks ? sqrtf(float(world.mouse_w * world.mouse_w + world.mouse_h * world.mouse_h)) / 2 : 0.0f;
+	bool is_near_wall = world.field.touches_circle(float(center_x), float(center_y), radius);
+
+	if (is_masks)
+	{
+		if (is_near_wall && check_collision_mask(world.walls, *mouse_mask, mouse_x, mouse_y))
+			snapshot.state = STATE_DEAD;
+		else if (mouse_mask->overlaps_mask(mouse_x, mouse_y, *key_mask, world.key_x, world.key_y))
+			snapshot.state = STATE_VICTORY;
+	}
+	else if (is_near_wall && world.walls.check_point(center_x, center_y))
+		snapshot.state = STATE_DEAD;
+	else if (check_collisoin_key(mouse_x, mouse_y, world.mouse_w, world.mouse_h, world.key_x, world.key_y))
+		snapshot.state = STATE_VICTORY;
+
+	snapshot.sequence++;
+}
+
+// поток симуляции: шаги логики с фиксированной частотой FPS независимо от скорости отрисовки
+void simulation_thread(SimulationInput* input, TripleBuffer<GameSnapshot>* buffer, SimulationWorld world, GameSnapshot snapshot)
+{
+	const Uint64 frequency = SDL_GetPerformanceFrequency();
+	const Uint64 step = frequency / FPS;
+	Uint64 next_step = SDL_GetPerformanceCounter();
+	Uint64 last_kursor = ~Uint64(0); // курсор, с которым был сделан прошлый шаг
+
+	while (input->is_running.load(std::memory_order_acquire))
+	{
+		bool is_level_changed = false;
+		while (LevelDiff* diff = input->level_diffs.pop()) // уровень изменился - правим только затронутые стенки
+		{
+			world.walls.apply(*diff);
+			world.field.update(world.walls, *diff, sdf_cell_size);
+			if (input->recorder != nullptr)
+				input->recorder->add_level_diff(*diff);
+			is_level_changed = is_level_changed || !diff->added.empty();
+			delete diff;
+		}
+
+		/* без нажатой кнопки и движения курсора шаг ничего не изменит - спим, пока ввод не изменится.
+		   Исключение - новые стенки: они могли появиться прямо на стоящей мышке, и шаг нужен для проверки столкновения */
+		if (!is_level_changed && !input->is_click.load() && input->kursor.load() == last_kursor)
+		{
+			input->is_simulation_idle.store(true);
+			if (!input->is_click.load() && input->kursor.load() == last_kursor && input->level_diffs.empty()
+				&& input->is_running.load())
+				SDL_SemWaitTimeout(input->wakeup, 250);
+			input->is_simulation_idle.store(false);
+			next_step = SDL_GetPerformanceCounter();
+			continue;
+		}
+
+		/* курсор читается как можно позже - непосредственно перед шагом */
+		int kursor_x = 0;
+		int kursor_y = 0;
+		Uint32 input_time = 0;
+		last_kursor = input->kursor.load(std::memory_order_relaxed);
+		unpack_kursor(last_kursor, kursor_x, kursor_y, input_time);
+		bool is_click = input->is_click.load(std::memory_order_relaxed);
+		if (input->recorder != nullptr)
+			input->recorder->add_step(kursor_x, kursor_y, is_click);
+
+		GameSnapshot previous = snapshot;
+		simulation_step(snapshot, world, kursor_x, kursor_y, is_click);
+		bool is_changed = !same_picture(previous, snapshot);
+		if (is_changed) // задержка считается только до кадров, которые ввод действительно изменил
+			snapshot.input_time = input_time;
+
+		buffer->write_buffer() = snapshot;
+		buffer->publish();
+
+		if (is_changed && input->is_main_waiting.load()) // будим главный поток ради нового кадра
+		{
+			SDL_Event wake;
+			SDL_zero(wake);
+			wake.type = SDL_USEREVENT;
+			SDL_PushEvent(&wake);
+		}
+
+		if (snapshot.state != STATE_PLAYING) // партия закончена, дальше решает главный поток
+			break;
+
+		next_step += step;
+		Uint64 now = SDL_GetPerformanceCounter();
+		if (next_step > now)
+			SDL_Delay(Uint32((next_step - now) * 1000 / frequency));
+		else if (now - next_step > step * 5) // сильно отстали (например, после паузы) - не догоняем
+			next_step = now;
+	}
+}
+#pragma endregion simulation_pipeline
+
+#pragma region fog_of_war
+// туман войны: освещена только область, которую мышка видит в радиусе radius.
+// Многоугольник видимости строится каждый кадр лучами к углам стенок рядом с мышкой (по возрастанию угла),
+// а стенки для лучей берутся из сетки WallIndex, поэтому время не зависит от общего числа стенок уровня
+class FogOfWar
+{
+	static const int CIRCLE_RAYS = 96; // равномерные лучи, чтобы край света без стенок был похож на круг
+	static const int SECTORS = 1024; // секторы буфера заслонения по псевдоуглу
+
+	struct Ray
+	{
+		float angle;
+		float x;
+		float y;
+	};
+
+	std::vector<const SDL_Rect*> near_walls;
+	std::vector<float> occlusion; // для каждого сектора: дальше этого расстояния все закрыто стенкой
+	std::vector<Ray> rays; // концы лучей по возрастанию угла - вершины многоугольника видимости
+	std::vector<SDL_Vertex> vertices;
+	std::vector<int> indices;
+
+	float origin_x = 0;
+	float origin_y = 0;
+
+	/* время построения многоугольника за партию */
+	double total_ms = 0;
+	double max_ms = 0;
+	int computations = 0;
+
+	// псевдоугол в [0, 4): монотонен по настоящему углу, но без atan2
+	static float pseudo_angle(float dx, float dy)
+	{
+		float p = dy / (fabsf(dx) + fabsf(dy));
+		return dx < 0 ? 2 - p : (dy < 0 ? 4 + p : p);
+	}
+
+	static int sector_of(float pseudo)
+	{
+		return std::min(int(pseudo * (SECTORS / 4)), SECTORS - 1);
+	}
+
+	// стенка закрывает все, что в секторах целиком внутри ее углового размера дальше ее дальнего угла
+	void occlude(const SDL_Rect& wall)
+	{
+		float low = 0, high = 0, base = 0, far_distance = 0;
+		const float corner_x[4] = { float(wall.x), float(wall.x + wall.w), float(wall.x), float(wall.x + wall.w) };
+		const float corner_y[4] = { float(wall.y), float(wall.y), float(wall.y + wall.h), float(wall.y + wall.h) };
+		for (int i = 0; i < 4; ++i)
+		{
+			float dx = corner_x[i] - origin_x;
+			float dy = corner_y[i] - origin_y;
+			if (dx == 0 && dy == 0)
+				return;
+
+			/* углы прямоугольника, не содержащего мышку, лежат в пределах полуокружности (2 в псевдоуглах) */
+			float p = pseudo_angle(dx, dy);
+			if (i == 0)
+				base = p;
+			float offset = p - base;
+			if (offset > 2)
+				offset -= 4;
+			else if (offset < -2)
+				offset += 4;
+			low = std::min(low, offset);
+			high = std::max(high, offset);
+			far_distance = std::max(far_distance, dx * dx + dy * dy);
+		}
+		if (origin_x > wall.x && origin_x < wall.x + wall.w && origin_y > wall.y && origin_y < wall.y + wall.h)
+			return;
+
+		/* луч точно по краю стенки ее не задевает, поэтому края с запасом не считаются закрытыми */
+		far_distance = sqrtf(far_distance);
+		const float width = 4.0f / SECTORS;
+		int first = int(ceilf((base + low + 1e-4f) / width));
+		int last = int(floorf((base + high - 1e-4f) / width)) - 1;
+		for (int sector = first; sector <= last; ++sector)
+		{
+			float& depth = occlusion[(sector % SECTORS + SECTORS) % SECTORS];
+			depth = std::min(depth, far_distance);
+		}
+	}
+
+	void add_ray(float angle) // луч до первой стенки или до края радиуса
+	{
+		float dx = cosf(angle);
+		float dy = sinf(angle);
+		float t = walls.cast_ray(origin_x, origin_y, dx, dy, radius);
+		rays.push_back({ angle, origin_x + dx * t, origin_y + dy * t });
+	}
+public:
+	WallIndex walls; // копия стенок уровня для главного потока (у потока симуляции своя)
+	float radius = 320.0f;
+
+	void compute(float x, float y)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+		origin_x = x;
+		origin_y = y;
+
+		/* отсечение по сетке: только стенки из клеток в квадрате вокруг мышки, каждая один раз */
+		near_walls.clear();
+		SDL_Rect area = { int(x - radius), int(y - radius), int(2 * radius) + 1, int(2 * radius) + 1 };
+		walls.any_near(area, [this](const SDL_Rect& wall)
+			{
+				near_walls.push_back(&wall);
+				return false;
+			});
+		std::sort(near_walls.begin(), near_walls.end());
+		near_walls.erase(std::unique(near_walls.begin(), near_walls.end()), near_walls.end());
+
+		/* отсечение по заслонению: буфер секторов по углу заполняется всеми стенками, после чего углы
+		   стенок, которые заведомо закрыты, отбрасываются без лучей */
+		occlusion.assign(SECTORS, radius + 1);
+		for (const SDL_Rect* wall : near_walls)
+			occlude(*wall);
+
+		/* точная проверка оставшихся углов лучом; к видимому углу добавляются лучи чуть левее и правее,
+		   чтобы заглянуть за него. Закрытый угол вершин не дает - их дают углы закрывающей стенки */
+		const float EPSILON = 0.0005f;
+		rays.clear();
+		for (int i = 0; i < int(near_walls.size()) * 4; ++i)
+		{
+			const SDL_Rect* wall = near_walls[i / 4];
+			float corner_x = float(wall->x + (i % 2 == 0 ? 0 : wall->w));
+			float corner_y = float(wall->y + (i % 4 < 2 ? 0 : wall->h));
+			float dx = corner_x - x;
+			float dy = corner_y - y;
+			float distance = sqrtf(dx * dx + dy * dy);
+			if (distance > radius || distance == 0)
+				continue;
+			if (occlusion[sector_of(pseudo_angle(dx, dy))] < distance - 0.5f)
+				continue;
+			if (walls.cast_ray(x, y, dx / distance, dy / distance, distance) < distance - 0.5f)
+				continue;
+
+			float angle = atan2f(dy, dx);
+			rays.push_back({ angle, corner_x, corner_y });
+			add_ray(angle - EPSILON);
+			add_ray(angle + EPSILON);
+		}
+		for (int i = 0; i < CIRCLE_RAYS; ++i)
+			add_ray(-3.1415927f + 6.2831853f * i / CIRCLE_RAYS);
+		std::sort(rays.begin(), rays.end(), [](const Ray& a, const Ray& b) { return a.angle < b.angle; });
+
+		double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+		total_ms += ms;
+		max_ms = std::max(max_ms, ms);
+		computations++;
+	}
+
+	bool is_visible(float x, float y) const // точка освещена: в радиусе и не закрыта стенкой
+	{
+		float dx = x - origin_x;
+		float dy = y - origin_y;
+		float distance = sqrtf(dx * dx + dy * dy);
+		if (distance > radius)
+			return false;
+		if (distance == 0)
+			return true;
+		return walls.cast_ray(origin_x, origin_y, dx / distance, dy / distance, distance) >= distance;
+	}
+
+	// освещенная часть фона: веер треугольников из мышки, текстурированный background, одним вызовом
+	void draw(const ObjectTexture& background)
+	{
+		if (rays.empty())
+			return;
+
+		int texture_w = 0;
+		int texture_h = 0;
+		SDL_QueryTexture(background.texture, NULL, NULL, &texture_w, &texture_h);
+		const SDL_Rect& src = background.src;
+		const SDL_Rect& dst = background.dst;
+
+		/* координаты текстуры - положение вершины на экране, пересчитанное из dst в src */
+		vertices.resize(rays.size() + 1);
+		for (size_t i = 0; i <= rays.size(); ++i)
+		{
+			float x = i == 0 ? origin_x : rays[i - 1].x;
+			float y = i == 0 ? origin_y : rays[i - 1].y;
+			SDL_Vertex& vertex = vertices[i];
+			vertex.position = { x, y };
+			vertex.color = { 255, 255, 255, 255 };
+			vertex.tex_coord.x = (src.x + (x - dst.x) * src.w / dst.w) / texture_w;
+			vertex.tex_coord.y = (src.y + (y - dst.y) * src.h / dst.h) / texture_h;
+		}
+
+		indices.resize(rays.size() * 3);
+		int count = int(rays.size());
+		for (int i = 0; i < count; ++i)
+		{
+			indices[i * 3 + 0] = 0;
+			indices[i * 3 + 1] = i + 1;
+			indices[i * 3 + 2] = (i + 1) % count + 1;
+		}
+
+		SDL_RenderGeometry(render, background.texture, vertices.data(), int(vertices.size()), indices.data(), int(indices.size()));
+	}
+
+	void report() // среднее и худшее время построения многоугольника за партию и сброс статистики
+	{
+		if (computations > 0)
+			std::cout << "Visibility polygon: avg = " << total_ms / computations << " ms, max = " << max_ms << " ms ("
+				<< computations << " frames)" << std::endl;
+		total_ms = 0;
+		max_ms = 0;
+		computations = 0;
+	}
+};
+#pragma endregion fog_of_war
+
+struct GameScene // текстуры игровой сцены, нужные для отрисовки кадра
+{
+	ObjectTexture* background = nullptr;
+	ObjectTexture* mouse = nullptr;
+	ObjectTexture* key = nullptr;
+	SDL_Texture* font = nullptr;
+	SDL_Rect font_dst = { 0, 0, 0, 0 };
+	const std::vector<SDL_Rect>* walls = nullptr; // геометрия стенок для отрисовки (обновляется по изменениям уровня)
+	FogOfWar* fog = nullptr; // туман войны (ключ --fog), nullptr - сцена видна целиком
+};
+
+// отрисовка стенок лабиринта одним вызовом
+void draw_walls(const std::vector<SDL_Rect>& walls)
+{
+	SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
+	SDL_RenderFillRects(render, walls.data(), int(walls.size()));
+}
+
+// отрисовка одного кадра игры по снимку мира (без SDL_RenderPresent)
+void draw_game_frame(GameScene& scene, const GameSnapshot& snapshot)
+{
+	SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
+	SDL_RenderClear(render);
+
+	/* отрисовка заднего фона; в тумане войны - только части, видимой из центра мышки */
+	if (scene.fog == nullptr)
+		SDL_RenderCopy(render, scene.background->texture, &scene.background->src, &scene.background->dst);
+	else
+	{
+		scene.fog->compute(snapshot.mouse_x + scene.mouse->dst.w / 2.0f, snapshot.mouse_y + scene.mouse->dst.h / 2.0f);
+		scene.fog->draw(*scene.background);
+	}
+
+	SDL_RenderCopy(render, scene.font, NULL, &scene.font_dst);
+
+	draw_walls(*scene.walls); // отрисовка стенок лабиринта
+
+	/* отрисовка мышки */
+	scene.mouse->dst.x = snapshot.mouse_x;
+	scene.mouse->dst.y = snapshot.mouse_y;
+	scene.mouse->src.x = snapshot.frame_x;
+	if (!snapshot.mirror)
+		SDL_RenderCopy(render, scene.mouse->texture, &scene.mouse->src, &scene.mouse->dst);
+	else
+		SDL_RenderCopyEx(render, scene.mouse->texture,
+			&scene.mouse->src, &scene.mouse->dst, 0, NULL, SDL_FLIP_HORIZONTAL);
+
+	/* отрисовка ключа (в тумане войны - только если его видно) */
+	if (scene.fog == nullptr || scene.fog->is_visible(scene.key->dst.x + scene.key->dst.w / 2.0f, scene.key->dst.y + scene.key->dst.h / 2.0f))
+		SDL_RenderCopy(render, scene.key->texture, &scene.key->src, &scene.key->dst);
+}
+
+// неподвижная часть сцены (отмасштабированный фон, стенки и ключик), заранее отрисованная в текстуру.
+// В режиме грязных прямоугольников каждый кадр восстанавливает из нее только области, которые
+// занимали мышка и счетчик времени, и рисует их заново
+class StaticScene
+{
+	SDL_Texture* texture = nullptr;
+	int width = 0;
+	int height = 0;
+
+	WallIndex walls; // сетка над стенками сцены: перерисовка изменившегося места берет только стенки рядом с ним
+	std::vector<SDL_Rect> nearby; // стенки рядом с перерисовываемым прямоугольником (буфер, чтобы не выделять память)
+
+	SDL_Rect last_mouse = { 0, 0, 0, 0 }; // области, занятые подвижными объектами в прошлом кадре
+	SDL_Rect last_font = { 0, 0, 0, 0 };
+	bool is_full_redraw = true; // следующий кадр нужно вывести целиком
+	bool is_preserved = false; // сохраняет ли рендер содержимое кадра после SDL_RenderPresent
+public:
+	StaticScene()
+	{
+		SDL_RendererInfo info;
+		if (SDL_GetRendererInfo(render, &info) == 0)
+			is_preserved = (info.flags & SDL_RENDERER_SOFTWARE) != 0; // программный рендер рисует прямо в поверхность окна
+	}
+
+	~StaticScene()
+	{
+		if (texture)
+			SDL_DestroyTexture(texture);
+	}
+
+	bool rebuild(GameScene& scene) // вызывается при старте партии и при SDL_WINDOWEVENT_RESIZED
+	{
+		if (texture == nullptr || width != window_width || height != window_height)
+		{
+			if (texture)
+				SDL_DestroyTexture(texture);
+
+			texture = SDL_CreateTexture(render, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+				window_width, window_height);
+			if (texture == nullptr)
+			{
+				std::cout << "Error SDL_CreateTexture(): " << SDL_GetError() << std::endl;
+				return false;
+			}
+			SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE); // непрозрачная копия без смешивания
+			width = window_width;
+			height = window_height;
+		}
+
+		walls.assign(*scene.walls);
+
+		SDL_SetRenderTarget(render, texture);
+		SDL_RenderClear(render);
+		SDL_RenderCopy(render, scene.background->texture, &scene.background->src, &scene.background->dst);
+		draw_walls(*scene.walls);
+		SDL_RenderCopy(render, scene.key->texture, &scene.key->src, &scene.key->dst);
+		SDL_SetRenderTarget(render, NULL);
+
+		is_full_redraw = true;
+		return true;
+	}
+
+	void update(GameScene& scene, const LevelDiff& diff) // перерисовка только тех мест, где стенки изменились
+	{
+		if (texture == nullptr)
+			return;
+
+		walls.apply(diff);
+
+		SDL_SetRenderTarget(render, texture);
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			for (const SDL_Rect& rect : pass == 0 ? diff.removed : diff.added)
+			{
+				nearby.clear();
+				walls.any_near(rect, [&](const SDL_Rect& wall)
+					{
+						if (SDL_HasIntersection(&wall, &rect))
+							nearby.push_back(wall);
+						return false;
+					});
+
+				SDL_RenderSetClipRect(render, &rect);
+				SDL_RenderCopy(render, scene.background->texture, &scene.background->src, &scene.background->dst);
+				draw_walls(nearby);
+				SDL_RenderCopy(render, scene.key->texture, &scene.key->src, &scene.key->dst);
+			}
+		}
+		SDL_RenderSetClipRect(render, NULL);
+		SDL_SetRenderTarget(render, NULL);
+
+		is_full_redraw = true;
+	}
+
+	void invalidate() // содержимое окна испорчено (меню, экран смерти, SDL_WINDOWEVENT_EXPOSED)
+	{
+		is_full_redraw = true;
+	}
+
+	// часть прямоугольника, лежащая в окне. SDL обрезает по текстуре только src, а dst оставляет прежним,
+	// поэтому копия с текстуры в то же место у края окна растянулась бы; пустой результат - {0, 0, 0, 0}
+	SDL_Rect clip(const SDL_Rect& rect) const
+	{
+		SDL_Rect bounds = { 0, 0, width, height };
+		SDL_Rect result = { 0, 0, 0, 0 };
+		if (!SDL_IntersectRect(&rect, &bounds, &result))
+			result = { 0, 0, 0, 0 };
+		return result;
+	}
+
+	void restore(const SDL_Rect& rect) // rect уже обрезан по окну
+	{
+		if (rect.w > 0 && rect.h > 0)
+			SDL_RenderCopy(render, texture, &rect, &rect);
+	}
+
+	// отрисовка кадра игры по снимку мира (без SDL_RenderPresent)
+	void draw_frame(GameScene& scene, const GameSnapshot& snapshot)
+	{
+		if (texture == nullptr)
+		{
+			draw_game_frame(scene, snapshot);
+			return;
+		}
+
+		if (is_full_redraw || !is_preserved)
+		{
+			SDL_RenderCopy(render, texture, NULL, NULL);
+			is_full_redraw = false;
+		}
+		else
+		{
+			restore(last_mouse);
+			restore(last_font);
+		}
+
+		SDL_RenderCopy(render, scene.font, NULL, &scene.font_dst);
 
-	x /= len;
-	y /= len;
+		scene.mouse->dst.x = snapshot.mouse_x;
+		scene.mouse->dst.y = snapshot.mouse_y;
+		scene.mouse->src.x = snapshot.frame_x;
+		if (!snapshot.mirror)
+			SDL_RenderCopy(render, scene.mouse->texture, &scene.mouse->src, &scene.mouse->dst);
+		else
+			SDL_RenderCopyEx(render, scene.mouse->texture,
+				&scene.mouse->src, &scene.mouse->dst, 0, NULL, SDL_FLIP_HORIZONTAL);
 
-	if (len > 30)
-	{
-		mouse_x += x * speed / FPS;
-		mouse_y += y * speed / FPS;
+		last_mouse = clip(scene.mouse->dst);
+		last_font = clip(scene.font_dst);
 	}
-	return len;
-}
+};
 
-// функция отрисовки стенок лабиринта и заполнения координатами четырех массивов для дальнейшего прохода
-int drawing_maze(int* wall_x, int* wall_y, int* wall_w, int* wall_h)
+// переход на новый набор стенок: считается разница с текущим уровнем, и только она применяется к геометрии
+// для отрисовки, к статической сцене и (через очередь) к сетке потока симуляции, если он запущен
+void change_level(std::vector<SDL_Rect>& level_walls, const std::vector<SDL_Rect>& new_walls,
+	GameScene& scene, StaticScene& static_scene, SimulationInput* input)
 {
-	int counter = 0;
-	SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
+	Uint64 start = SDL_GetPerformanceCounter();
 
-	SDL_Rect rect = {90, 80, 10, window_height / 1.4 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = {90, 80, 200, 10};
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = {170, 0, 10, 80};
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = {390, 80, 775, 10};
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 1165, 80, 10, 200 }; // 5
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 1165, 340, 10, 300 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 1165, 490, 85, 10 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 90, 640, 1085, 10 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 170, 150, 10, 430 }; // 9
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 170, 150, 300, 10 }; 
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 570, 150, 520, 10 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 1090, 150, 10, 190 }; // 12
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 1090, 400, 10, 180 }; 
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 170, 580, 930, 10 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 90, 400, 80, 10 }; // 15
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 770, 80, 10, 70 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 250, 230, 10, 270 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 250, 230, 220, 10 }; // 18
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 250, 500, 110, 10 }; 
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 470, 230, 10, 100 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 390, 330, 90, 10 }; // 21
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 390, 330, 10, 90 }; 
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 390, 420, 500, 10 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 740, 230, 10, 190 }; // 24
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 740, 230, 260, 10 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 1000, 230, 10, 270 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 450, 500, 560, 10 }; // 27
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 700, 500, 10, 80 }; 
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-
-	rect = { 830, 310, 170, 10 };
-	SDL_RenderFillRect(render, &rect);
-	wall_x[counter] = rect.x;
-	wall_y[counter] = rect.y;
-	wall_w[counter] = rect.w;
-	wall_h[counter] = rect.h;
-	counter++;
-	
-	return counter;
-}
+	LevelDiff diff = diff_walls(level_walls, new_walls);
+	if (diff.empty())
+		return;
 
-// проверка столкновения координат мышки с координатами стенки
-bool check_collision_wall(int mouse_x, int mouse_y,int mouse_w, int mouse_h, int* wall_x, int* wall_y, int* wall_w, int* wall_h, int counter)
-{
-	for (int i = 0; i < counter; ++i)
+	apply_diff(level_walls, diff);
+	static_scene.update(scene, diff);
+	if (scene.fog != nullptr)
+		scene.fog->walls.apply(diff);
+
+	std::cout << "Level changed: -" << diff.removed.size() << " +" << diff.added.size() << " walls in "
+		<< (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency() << " ms" << std::endl;
+
+	if (input != nullptr && input->is_running.load())
 	{
-		if ((mouse_x + (mouse_w / 2) < wall_x[i] + wall_w[i]) &&
-			(mouse_x + (mouse_w / 2) > wall_x[i]) &&
-			(mouse_y + (mouse_h / 2) < wall_y[i] + wall_h[i]) &&
-			(mouse_y + (mouse_h / 2) > wall_y[i]))
-		{
-			std::cout << "Mouse!!!: " << mouse_x << ' ' << mouse_y << std::endl;
-			std::cout << "Wall!!!: " << wall_x[counter - 1] << ' ' << wall_h[counter - 1] << std::endl;
-			return true;
-		}
+		LevelDiff* message = new LevelDiff(std::move(diff));
+		while (!input->level_diffs.push(message)) // очередь переполнена - ждем, пока симуляция ее разберет
+			SDL_Delay(1);
+		input->wake_simulation(); // симуляция могла уснуть со стоящей мышкой
 	}
-	return false;
-}
-
-// проверка столкновения мышки с ключиком (случай выигрыша)
-bool check_collisoin_key(int mouse_x, int mouse_y, int mouse_w, int mouse_h, int key_x, int key_y)
-{
-	if ((mouse_x + (mouse_w / 2) < key_x + 50) && (mouse_x + (mouse_w / 2) > key_x) 
-		&& (mouse_y + (mouse_h / 2) < key_y + 50) && (mouse_y + (mouse_h / 2) > key_y))
-		return true;
-	return false;
 }
 
 // функция для игрового меню
@@ -651,31 +2740,292 @@ bool game_menu(SDL_Texture* background, SDL_Rect src, SDL_Rect dst)
 	return true;
 }
 
-// функция для отображения смерти мышки от касания об стенку
-void deadly_screen(SDL_Texture* background, SDL_Rect src, SDL_Rect dst)
+#pragma region particles
+struct ParticleEmitter // параметры вспышки частиц
+{
+	float speed_min; // начальная скорость, пикселей в секунду
+	float speed_max;
+	float life_min; // время жизни, секунд
+	float life_max;
+	float gravity; // ускорение вниз, пикселей в секунду за секунду
+	SDL_Color color_a; // цвет частицы выбирается между color_a и color_b
+	SDL_Color color_b;
+};
+
+const ParticleEmitter DEATH_EMITTER = { 60.0f, 420.0f, 0.6f, 2.8f, 380.0f, { 120, 0, 0, 255 }, { 60, 60, 60, 255 } };
+const ParticleEmitter VICTORY_EMITTER = { 120.0f, 520.0f, 1.0f, 2.5f, 260.0f, { 255, 215, 0, 255 }, { 255, 255, 200, 255 } };
+
+const int DEATH_BURST = 50000; // частиц во вспышке при смерти
+const int VICTORY_BURST = 30000; // частиц во вспышке при победе
+const int VICTORY_FOUNTAIN = 300; // частиц за кадр, пока показан экран победы
+
+// пул частиц фиксированного размера в виде структуры массивов: память выделяется один раз при создании,
+// шаг обновления - простые циклы по массивам float, которые компилятор векторизует, а отрисовка -
+// один вызов SDL_RenderGeometryRaw по всем частицам с маленьким спрайтом круга
+class ParticleSystem
+{
+	static const int SPRITE_SIZE = 8; // размер спрайта частицы в текстуре
+	static const int PARTICLE_SIZE = 4; // размер частицы на экране
+
+	int capacity = 0;
+	int count = 0; // живые частицы всегда лежат в начале массивов
+	Uint32 random_state = 0x9E3779B9;
+
+	/* состояние частиц */
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> vx;
+	std::vector<float> vy;
+	std::vector<float> gravity;
+	std::vector<float> life; // оставшееся время жизни
+	std::vector<float> fade; // 255 / полное время жизни - скорость исчезновения
+	std::vector<SDL_Color> color;
+
+	/* буферы вершин для отрисовки: uv и индексы не меняются и заполняются один раз */
+	std::vector<float> vertex_xy;
+	std::vector<SDL_Color> vertex_color;
+	std::vector<float> vertex_uv;
+	std::vector<int> indices;
+	SDL_Texture* sprite = nullptr;
+
+	// шаг движения без ветвлений; __restrict у параметров сообщает компилятору, что массивы не пересекаются,
+	// и цикл векторизуется без проверок во время выполнения
+	static void integrate(float* __restrict x, float* __restrict y, float* __restrict vx, float* __restrict vy,
+		float* __restrict life, const float* __restrict gravity, int count, float dt)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			vy[i] += gravity[i] * dt;
+			x[i] += vx[i] * dt;
+			y[i] += vy[i] * dt;
+			life[i] -= dt;
+		}
+	}
+
+	float random_float(float min, float max) // xorshift32: быстрый и воспроизводимый (для записи в видео)
+	{
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 17;
+		random_state ^= random_state << 5;
+		return min + (max - min) * float(random_state >> 8) / float(1 << 24);
+	}
+public:
+	explicit ParticleSystem(int max_particles = 1 << 16)
+		: capacity(max_particles), x(max_particles), y(max_particles), vx(max_particles), vy(max_particles),
+		gravity(max_particles), life(max_particles), fade(max_particles), color(max_particles),
+		vertex_xy(size_t(max_particles) * 8), vertex_color(size_t(max_particles) * 4),
+		vertex_uv(size_t(max_particles) * 8), indices(size_t(max_particles) * 6)
+	{
+		for (int i = 0; i < capacity; ++i)
+		{
+			const float uv[8] = { 0, 0, 1, 0, 1, 1, 0, 1 };
+			std::copy(uv, uv + 8, &vertex_uv[size_t(i) * 8]);
+
+			const int quad[6] = { 0, 1, 2, 0, 2, 3 };
+			for (int k = 0; k < 6; ++k)
+				indices[size_t(i) * 6 + k] = i * 4 + quad[k];
+		}
+	}
+
+	~ParticleSystem()
+	{
+		if (sprite)
+			SDL_DestroyTexture(sprite);
+	}
+
+	bool create_sprite() // мягкий белый круг; цвет частице задают вершины. Вызывать после создания рендера
+	{
+		sprite = SDL_CreateTexture(render, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, SPRITE_SIZE, SPRITE_SIZE);
+		if (sprite == nullptr)
+		{
+			std::cout << "Error SDL_CreateTexture(): " << SDL_GetError() << std::endl;
+			return false;
+		}
+
+		Uint32 pixels[SPRITE_SIZE * SPRITE_SIZE];
+		float radius = SPRITE_SIZE / 2.0f;
+		for (int py = 0; py < SPRITE_SIZE; ++py)
+		{
+			for (int px = 0; px < SPRITE_SIZE; ++px)
+			{
+				float dx = px + 0.5f - radius;
+				float dy = py + 0.5f - radius;
+				float alpha = std::max(0.0f, std::min(1.0f, radius - sqrtf(dx * dx + dy * dy)));
+				pixels[py * SPRITE_SIZE + px] = (Uint32(alpha * 255) << 24) | 0xFFFFFF;
+			}
+		}
+		SDL_UpdateTexture(sprite, NULL, pixels, SPRITE_SIZE * 4);
+		SDL_SetTextureBlendMode(sprite, SDL_BLENDMODE_BLEND);
+		return true;
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+	void clear()
+	{
+		count = 0;
+	}
+
+	// вспышка из number частиц в точке (cx, cy); сверх емкости пула частицы не создаются
+	void emit(const ParticleEmitter& emitter, int number, float cx, float cy)
+	{
+		number = std::min(number, capacity - count);
+		for (int i = count; i < count + number; ++i)
+		{
+			float angle = random_float(0.0f, 6.2831853f);
+			float speed = random_float(emitter.speed_min, emitter.speed_max);
+			float lifetime = random_float(emitter.life_min, emitter.life_max);
+			float t = random_float(0.0f, 1.0f);
+
+			x[i] = cx;
+			y[i] = cy;
+			vx[i] = cosf(angle) * speed;
+			vy[i] = sinf(angle) * speed;
+			gravity[i] = emitter.gravity;
+			life[i] = lifetime;
+			fade[i] = 255.0f / lifetime;
+			color[i].r = Uint8(emitter.color_a.r + (emitter.color_b.r - emitter.color_a.r) * t);
+			color[i].g = Uint8(emitter.color_a.g + (emitter.color_b.g - emitter.color_a.g) * t);
+			color[i].b = Uint8(emitter.color_a.b + (emitter.color_b.b - emitter.color_a.b) * t);
+			color[i].a = 255;
+		}
+		count += number;
+	}
+
+	void update(float dt)
+	{
+		integrate(x.data(), y.data(), vx.data(), vy.data(), life.data(), gravity.data(), count, dt);
+
+		/* погасшие частицы убираются сдвигом живых к началу массивов */
+		int alive = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			if (life[i] <= 0)
+				continue;
+
+			if (alive != i)
+			{
+				x[alive] = x[i];
+				y[alive] = y[i];
+				vx[alive] = vx[i];
+				vy[alive] = vy[i];
+				gravity[alive] = gravity[i];
+				life[alive] = life[i];
+				fade[alive] = fade[i];
+				color[alive] = color[i];
+			}
+			alive++;
+		}
+		count = alive;
+	}
+
+	void draw() // все частицы одним вызовом; прозрачность частицы падает к концу ее жизни
+	{
+		if (count == 0 || sprite == nullptr)
+			return;
+
+		const float half = PARTICLE_SIZE / 2.0f;
+		float* xy = vertex_xy.data();
+		for (int i = 0; i < count; ++i)
+		{
+			float left = x[i] - half;
+			float top = y[i] - half;
+			float right = x[i] + half;
+			float bottom = y[i] + half;
+			xy[i * 8 + 0] = left;
+			xy[i * 8 + 1] = top;
+			xy[i * 8 + 2] = right;
+			xy[i * 8 + 3] = top;
+			xy[i * 8 + 4] = right;
+			xy[i * 8 + 5] = bottom;
+			xy[i * 8 + 6] = left;
+			xy[i * 8 + 7] = bottom;
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			SDL_Color c = color[i];
+			c.a = Uint8(std::min(255.0f, life[i] * fade[i]));
+			vertex_color[size_t(i) * 4 + 0] = c;
+			vertex_color[size_t(i) * 4 + 1] = c;
+			vertex_color[size_t(i) * 4 + 2] = c;
+			vertex_color[size_t(i) * 4 + 3] = c;
+		}
+
+		SDL_RenderGeometryRaw(render, sprite, vertex_xy.data(), 2 * sizeof(float), vertex_color.data(), sizeof(SDL_Color),
+			vertex_uv.data(), 2 * sizeof(float), count * 4, indices.data(), count * 6, sizeof(int));
+	}
+};
+#pragma endregion particles
+
+// кадр экрана смерти (без SDL_RenderPresent)
+void draw_deadly_frame(SDL_Texture* background, SDL_Rect src, SDL_Rect dst, const ObjectTexture& dead_object,
+	ParticleSystem& particles)
+{
+	SDL_RenderClear(render);
+	SDL_RenderCopy(render, background, &src, &dst);
+	SDL_RenderCopy(render, dead_object.texture, &dead_object.src, &dead_object.dst);
+	particles.draw();
+}
+
+// кадр экрана победы со временем прохождения (без SDL_RenderPresent)
+void draw_victory_frame(SDL_Texture* background, SDL_Rect src, SDL_Rect dst, const ObjectTexture& victory_object,
+	SDL_Texture* font_texture, SDL_Rect font_dst, ParticleSystem& particles)
 {
 	SDL_RenderClear(render);
 	SDL_RenderCopy(render, background, &src, &dst);
 
+	particles.draw();
+	SDL_RenderCopy(render, victory_object.texture, &victory_object.src, &victory_object.dst);
+	SDL_RenderCopy(render, font_texture, NULL, &font_dst);
+}
+
+// функция для отображения смерти мышки от касания об стенку; (x, y) - где мышка разлетается на частицы
+void deadly_screen(SDL_Texture* background, SDL_Rect src, SDL_Rect dst, ParticleSystem& particles, int x, int y)
+{
 	ObjectTexture dead_object;
 	SDL_Texture* dead_texture = dead_object.create_texture("died.png");
 	dead_object.set_dst(450, 300, 350, 300);
 
-	SDL_RenderCopy(render, dead_texture, &dead_object.src, &dead_object.dst);
-	SDL_RenderPresent(render);
+	particles.clear();
+	particles.emit(DEATH_EMITTER, DEATH_BURST, float(x), float(y));
+
+	/* экран смерти держится 3 секунды, пока разлетаются частицы */
+	Uint32 start_time = SDL_GetTicks();
+	Uint32 last_time = start_time;
+	while (SDL_GetTicks() - start_time < 3000)
+	{
+		Uint32 now = SDL_GetTicks();
+		particles.update(std::min(now - last_time, Uint32(100)) / 1000.0f);
+		last_time = now;
+
+		draw_deadly_frame(background, src, dst, dead_object, particles);
+		SDL_RenderPresent(render);
 
-	SDL_Delay(3000);
+		Uint32 frame_time = SDL_GetTicks() - now;
+		if (frame_time < Uint32(1000 / FPS))
+			SDL_Delay(1000 / FPS - frame_time);
+	}
+	particles.clear();
 
 	SDL_DestroyTexture(dead_texture);
 }
 
-// функция для отображения победы 
-void victory_screen(SDL_Texture* background, SDL_Rect src, SDL_Rect dst, SDL_Texture* font_texture, SDL_Rect font_dst)
+// функция для отображения победы; из (x, y) бьет фонтан частиц
+void victory_screen(SDL_Texture* background, SDL_Rect src, SDL_Rect dst, SDL_Texture* font_texture, SDL_Rect font_dst,
+	ParticleSystem& particles, int x, int y)
 {
 	ObjectTexture victory_object;
 	SDL_Texture* victory_texture = victory_object.create_texture("victory_sheet.png");
 	victory_object.set_dst(450, 190, 300, 150);
 
+	particles.clear();
+	particles.emit(VICTORY_EMITTER, VICTORY_BURST, float(x), float(y));
+	Uint32 last_time = SDL_GetTicks();
+
 	SDL_Event event;
 	bool is_running = true;
 
@@ -693,17 +3043,21 @@ void victory_screen(SDL_Texture* background, SDL_Rect src, SDL_Rect dst, SDL_Tex
 			}
 		}
 
-#pragma region drawing_victory
-		SDL_RenderClear(render);
-		SDL_RenderCopy(render, background, &src, &dst);
-
-		SDL_RenderCopy(render, victory_texture, &victory_object.src, &victory_object.dst);
-		SDL_RenderCopy(render, font_texture, NULL, &font_dst);
+		Uint32 now = SDL_GetTicks();
+		particles.emit(VICTORY_EMITTER, VICTORY_FOUNTAIN, float(x), float(y));
+		particles.update(std::min(now - last_time, Uint32(100)) / 1000.0f);
+		last_time = now;
 
+#pragma region drawing_victory
+		draw_victory_frame(background, src, dst, victory_object, font_texture, font_dst, particles);
 		SDL_RenderPresent(render);
 #pragma endregion drawing_victory
 
+		Uint32 frame_time = SDL_GetTicks() - now;
+		if (frame_time < Uint32(1000 / FPS))
+			SDL_Delay(1000 / FPS - frame_time);
 	}
+	particles.clear();
 
 	SDL_DestroyTexture(victory_texture);
 }
@@ -725,20 +3079,242 @@ void Deinit_SDL2(SDL_Texture* background, SDL_Texture* mouse, SDL_Texture* key,
 	std::cout << "Deinit end" << std::endl;
 }
 
+// офлайн-воспроизведение записанных партий в видео: программный рендер рисует в поверхность без окна,
+// шаги симуляции идут без ожидания реального времени, каждый кадр читается SDL_RenderReadPixels в VideoWriter
+int render_replay(const std::string& replay_file, const std::string& video_file)
+{
+	std::vector<ReplayRound> rounds;
+	if (!load_replay(replay_file, rounds))
+		return 1;
+
+	/* размер видео - размер окна в первой партии, остальные партии масштабируются под него */
+	int video_w = rounds[0].width;
+	int video_h = rounds[0].height;
+	SDL_Surface* target = SDL_CreateRGBSurfaceWithFormat(0, video_w, video_h, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (target == nullptr)
+	{
+		std::cout << "Error SDL_CreateRGBSurfaceWithFormat(): " << SDL_GetError() << std::endl;
+		return 1;
+	}
+	Init_SDL2(0, target);
+	if (!assets.open(bundle_filename.c_str()))
+		std::cout << "Asset bundle " << bundle_filename << " not loaded, using separate files" << std::endl;
+
+	int result = 0;
+	{
+		window_width = video_w;
+		window_height = video_h;
+
+		/* те же текстуры и маски, что в main() */
+		ObjectTexture background_object;
+		background_object.create_texture("background.jpg", window_width, window_height);
+
+		ObjectTexture mouse_left_right_object;
+		mouse_left_right_object.create_texture("mouse_running_left_right.png");
+		mouse_left_right_object.set_src(0, 0, mouse_left_right_object.src.h + 3, mouse_left_right_object.src.h);
+		mouse_left_right_object.set_dst(mouse_x, mouse_y, 75, 65);
+
+		ObjectTexture key_object;
+		key_object.create_texture("key.png");
+		key_object.set_dst(940, 265, 50, 50);
+
+		ObjectTexture dead_object;
+		dead_object.create_texture("died.png");
+		dead_object.set_dst(450, 300, 350, 300);
+
+		ObjectTexture victory_object;
+		victory_object.create_texture("victory_sheet.png");
+		victory_object.set_dst(450, 190, 300, 150);
+
+		SpriteMasks mouse_masks;
+		SpriteMasks key_masks;
+		bool is_masks = load_sprite_masks("mouse_running_left_right.png", mouse_left_right_object.src, count_frame,
+			mouse_left_right_object.dst.w, mouse_left_right_object.dst.h, mouse_masks)
+			&& load_sprite_masks("key.png", key_object.src, 1, key_object.dst.w, key_object.dst.h, key_masks);
+
+		ParticleSystem particles;
+		particles.create_sprite();
+
+		TTF_Font* font = open_font("ebrimabd.ttf", 32);
+		VideoWriter video;
+		if (font == nullptr || !video.open(video_file, video_w, video_h, FPS))
+			result = 1;
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (size_t r = 0; r < rounds.size() && result == 0; ++r)
+		{
+			const ReplayRound& round = rounds[r];
+			SDL_RenderSetLogicalSize(render, round.width, round.height);
+			background_object.set_dst(0, 0, round.width, round.height);
+
+			std::vector<SDL_Rect> level_walls = round.walls;
+			if (!round.is_walls_recorded)
+			{
+				std::cout << "Replay round " << r + 1 << ": walls are not recorded, using the current level" << std::endl;
+				level_walls = builtin_level(round.height);
+				if (!level_filename.empty())
+					load_level(level_filename, level_walls);
+			}
+
+			SimulationWorld world;
+			world.walls.assign(level_walls);
+			world.field.bake(level_walls, sdf_cell_size);
+			world.mouse_w = mouse_left_right_object.dst.w;
+			world.mouse_h = mouse_left_right_object.dst.h;
+			world.frame_w = mouse_left_right_object.src.w;
+			world.key_x = key_object.dst.x;
+			world.key_y = key_object.dst.y;
+			if (is_masks)
+			{
+				world.mouse_masks = &mouse_masks;
+				world.key_masks = &key_masks;
+			}
+
+			mouse_x = round.mouse_x;
+			mouse_y = round.mouse_y;
+			frame = round.frame;
+			GameSnapshot snapshot;
+			snapshot.mouse_x = mouse_x;
+			snapshot.mouse_y = mouse_y;
+			snapshot.frame_x = round.frame_x;
+
+			GameScene scene;
+			scene.background = &background_object;
+			scene.mouse = &mouse_left_right_object;
+			scene.key = &key_object;
+			scene.walls = &level_walls;
+			FogOfWar fog;
+			if (is_fog)
+			{
+				fog.walls.assign(level_walls);
+				scene.fog = &fog;
+			}
+			Uint32 shown_time = Uint32(-1);
+			int end_frames = 0; // сколько кадров уже показан экран смерти или победы
+
+			size_t next = 0; // следующий шаг записи
+			for (Uint64 n = 0; ; ++n)
+			{
+				/* кадр n показывает мир после всех шагов, сделанных к его времени */
+				Uint32 time = Uint32(n * 1000 / FPS);
+				while (snapshot.state == STATE_PLAYING && next < round.steps.size() && round.steps[next].time <= time)
+				{
+					const ReplayStep& step = round.steps[next++];
+					for (const LevelDiff& diff : step.levels) // стенки менялись во время записи - повторяем это здесь
+					{
+						apply_diff(level_walls, diff);
+						world.walls.apply(diff);
+						world.field.update(world.walls, diff, sdf_cell_size);
+						if (is_fog)
+							fog.walls.apply(diff);
+					}
+					simulation_step(snapshot, world, step.kursor_x, step.kursor_y, step.is_click);
+				}
+				if (snapshot.state == STATE_PLAYING && next >= round.steps.size()) // партию прервали выходом из игры
+					break;
+				if (snapshot.state != STATE_PLAYING && end_frames++ >= 3 * FPS) // экран смерти или победы держится 3 с
+					break;
+
+				if (snapshot.state == STATE_PLAYING && time / 1000 != shown_time)
+				{
+					char str[15];
+					shown_time = time / 1000;
+					snprintf(str, sizeof(str), "Time %02i:%02i", shown_time / 60, shown_time % 60);
+
+					SDL_Surface* surface_font = TTF_RenderText_Blended(font, str, { 255, 255, 255, 255 });
+					SDL_DestroyTexture(scene.font);
+					scene.font = SDL_CreateTextureFromSurface(render, surface_font);
+					scene.font_dst = { 0, 0, surface_font->w, surface_font->h };
+					SDL_FreeSurface(surface_font);
+				}
+
+				/* частицы, как в deadly_screen() и victory_screen(), но с шагом ровно в один кадр видео */
+				if (snapshot.state != STATE_PLAYING)
+				{
+					if (end_frames == 1)
+					{
+						particles.clear();
+						if (snapshot.state == STATE_DEAD)
+							particles.emit(DEATH_EMITTER, DEATH_BURST, float(snapshot.mouse_x + world.mouse_w / 2),
+								float(snapshot.mouse_y + world.mouse_h / 2));
+						else
+							particles.emit(VICTORY_EMITTER, VICTORY_BURST, float(world.key_x + 25), float(world.key_y + 25));
+					}
+					else
+					{
+						if (snapshot.state == STATE_VICTORY)
+							particles.emit(VICTORY_EMITTER, VICTORY_FOUNTAIN, float(world.key_x + 25), float(world.key_y + 25));
+						particles.update(1.0f / FPS);
+					}
+				}
+
+				if (snapshot.state == STATE_DEAD)
+					draw_deadly_frame(background_object.texture, background_object.src, background_object.dst, dead_object, particles);
+				else if (snapshot.state == STATE_VICTORY)
+					draw_victory_frame(background_object.texture, background_object.src, background_object.dst, victory_object,
+						scene.font, { 500, 350, scene.font_dst.w, scene.font_dst.h }, particles);
+				else
+					draw_game_frame(scene, snapshot);
+
+				SDL_RenderReadPixels(render, NULL, SDL_PIXELFORMAT_ARGB8888, video.frame_buffer(), video_w * 4);
+				video.submit();
+			}
+			SDL_DestroyTexture(scene.font);
+			fog.report();
+		}
+		video.close();
+
+		double seconds = double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+		std::cout << "Replay: " << video.frame_count() << " frames in " << seconds << " s ("
+			<< (seconds > 0 ? video.frame_count() / seconds : 0) << " frames/s)" << std::endl;
+		if (font != nullptr)
+			TTF_CloseFont(font);
+	}
+
+	Deinit_SDL2(nullptr, nullptr, nullptr, nullptr);
+	SDL_FreeSurface(target);
+	return result;
+}
+
+#ifndef MOUSE_GAME_NO_MAIN // бенчмарк подключает этот файл целиком и использует свою main()
 int main(int argc, char* argv[])
 {
+	for (int i = 1; i < argc; ++i) // разбор ключей командной строки
+	{
+		std::string arg = argv[i];
+		if (arg == "--dirty-rect")
+			is_dirty_rect = true;
+		else if (arg == "--fog")
+			is_fog = true;
+		else if (arg == "--level" && i + 1 < argc)
+			level_filename = argv[++i];
+		else if (arg == "--bundle" && i + 1 < argc)
+			bundle_filename = argv[++i];
+		else if (arg == "--sdf-cell" && i + 1 < argc)
+			sdf_cell_size = std::max(0, atoi(argv[++i]));
+		else if (arg == "--record" && i + 1 < argc)
+			record_filename = argv[++i];
+		else if (arg == "--replay" && i + 1 < argc)
+			replay_filename = argv[++i];
+		else if (arg == "--video" && i + 1 < argc)
+			video_filename = argv[++i];
+	}
+
+	if (!replay_filename.empty()) // воспроизведение записи в видео вместо игры
+		return render_replay(replay_filename, video_filename);
+	if (is_fog && is_dirty_rect) // в тумане войны освещенная область меняется вместе с мышкой - кадр рисуется целиком
+	{
+		std::cout << "--dirty-rect is ignored with --fog" << std::endl;
+		is_dirty_rect = false;
+	}
+
 	Init_SDL2(SDL_INIT_VIDEO | SDL_INIT_AUDIO); // инициализируем видео и аудио
+	if (!assets.open(bundle_filename.c_str())) // без пакета ресурсов картинки декодируются из файлов
+		std::cout << "Asset bundle " << bundle_filename << " not loaded, using separate files" << std::endl;
 	Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048); // настраиваем звук
 	Mix_Music* music = Mix_LoadMUS("swingin-and-singin.wav"); // загрузка трека в формате wav
 	
-	// массивы для хранения координат стенок лабиринта, а также их размеры
-	int wall_x[MAX_COUNT]{};
-	int wall_y[MAX_COUNT]{};
-	int wall_w[MAX_COUNT]{};
-	int wall_h[MAX_COUNT]{};
-
 #pragma region bulean_variables
-	bool mirror = false; // зеркальный рендер мышки на экране при беге влево
 	bool is_mouse_button_click = false; // при нажатии л. кнопки мыши персонаж бежит за курсором
 	bool is_start = false; // флаг нажатии кнопки start в меню
 	bool is_running_game = true; // состояние игрового цикла
@@ -747,7 +3323,7 @@ int main(int argc, char* argv[])
 #pragma region loading_textures
 	/* загрузка текстуры заднего фона */
 	ObjectTexture background_object;
-	SDL_Texture* background_texture = background_object.create_texture("background.jpg");
+	SDL_Texture* background_texture = background_object.create_texture("background.jpg", window_width, window_height);
 	background_object.set_dst(0, 0, window_width, window_height);
 
 	/*загрузка текстуры мышки при беге вправо/влево */
@@ -765,10 +3341,21 @@ int main(int argc, char* argv[])
 	ObjectTexture fail_screen_object;
 	SDL_Texture* fail_screen_texture = fail_screen_object.create_texture("died.png");
 	fail_screen_object.set_dst(500, 380, 300, 260);
+
+	/* пул частиц для экранов смерти и победы */
+	ParticleSystem particles;
+	particles.create_sprite();
+
+	/* маски столкновений для кадров мышки (с отраженными копиями) и ключика в размерах на экране */
+	SpriteMasks mouse_masks;
+	SpriteMasks key_masks;
+	bool is_masks = load_sprite_masks("mouse_running_left_right.png", mouse_left_right_object.src, count_frame,
+		mouse_left_right_object.dst.w, mouse_left_right_object.dst.h, mouse_masks)
+		&& load_sprite_masks("key.png", key_object.src, 1, key_object.dst.w, key_object.dst.h, key_masks);
 #pragma endregion loading_textures
 
 	/* загрузка шрифта для времени и дальнейшего изменения */
-	TTF_Font* font = TTF_OpenFont("ebrimabd.ttf", 32);
+	TTF_Font* font = open_font("ebrimabd.ttf", 32);
 	char str[15] = "Time 00:00";
 	SDL_Surface* surface_font = TTF_RenderText_Blended(font, str, { 255, 255, 255, 255 });
 	SDL_Texture* texture_font = SDL_CreateTextureFromSurface(render, surface_font);
@@ -777,9 +3364,47 @@ int main(int argc, char* argv[])
 	/* переменные для подсчета времени */
 	Uint32 start_time = 0;
 	Uint32 elapsed_time = 0;
+	Uint32 shown_time = 0; // время, которое сейчас выведено в текстуре шрифта
+
+	/* состояние окна и последнего выведенного кадра для пропуска одинаковых кадров */
+	bool is_window_visible = true; // окно не свернуто и не скрыто
+	bool is_window_focused = true;
+	bool is_redraw = true; // кадр нужно вывести, даже если снимок мира не изменился
+	GameSnapshot drawn_snapshot; // снимок, по которому нарисован последний кадр
+
+	/* данные конвейера симуляции: ввод для потока логики и буфер снимков мира */
+	SimulationInput simulation_input;
+	simulation_input.wakeup = SDL_CreateSemaphore(0);
+	TripleBuffer<GameSnapshot> snapshots;
+	std::thread simulation;
+	LatencyStats latency;
+	ReplayRecorder recorder;
+	if (!record_filename.empty() && recorder.open(record_filename))
+		simulation_input.recorder = &recorder;
+
+	GameScene scene;
+	scene.background = &background_object;
+	scene.mouse = &mouse_left_right_object;
+	scene.key = &key_object;
+	StaticScene static_scene;
+
+	/* стенки текущего уровня: встроенный лабиринт или файл, который перезагружается при изменении */
+	std::vector<SDL_Rect> level_walls = builtin_level(window_height);
+	LevelWatcher level_watcher;
+	if (!level_filename.empty())
+	{
+		load_level(level_filename, level_walls);
+		level_watcher.start(level_filename);
+	}
+	scene.walls = &level_walls;
+
+	FogOfWar fog;
+	if (is_fog)
+	{
+		fog.walls.assign(level_walls);
+		scene.fog = &fog;
+	}
 
-	int counter = 0;
-	float len = 0;
 	Mix_PlayMusic(music, -1);
 
 		/* начало основного цикла игры */
@@ -790,14 +3415,71 @@ int main(int argc, char* argv[])
 			if (!is_start)
 				is_running_game = false;
 			start_time = SDL_GetTicks();
+
+			if (is_start) // запуск потока симуляции на новую партию
+			{
+				std::vector<SDL_Rect> new_walls;
+				if (level_watcher.poll() && load_level(level_filename, new_walls))
+					change_level(level_walls, new_walls, scene, static_scene, nullptr);
+
+				SimulationWorld world;
+				world.walls.assign(level_walls);
+				world.field.bake(level_walls, sdf_cell_size);
+				world.mouse_w = mouse_left_right_object.dst.w;
+				world.mouse_h = mouse_left_right_object.dst.h;
+				world.frame_w = mouse_left_right_object.src.w;
+				world.key_x = key_object.dst.x;
+				world.key_y = key_object.dst.y;
+				if (is_masks)
+				{
+					world.mouse_masks = &mouse_masks;
+					world.key_masks = &key_masks;
+				}
+
+				GameSnapshot snapshot;
+				snapshot.mouse_x = mouse_x;
+				snapshot.mouse_y = mouse_y;
+				snapshot.frame_x = mouse_left_right_object.src.x;
+				snapshots.reset(snapshot);
+
+				if (simulation_input.recorder != nullptr)
+				{
+					ReplayRound round;
+					round.width = window_width;
+					round.height = window_height;
+					round.mouse_x = mouse_x;
+					round.mouse_y = mouse_y;
+					round.frame = frame;
+					round.frame_x = snapshot.frame_x;
+					round.walls = level_walls;
+					recorder.start_round(start_time, round);
+				}
+
+				is_mouse_button_click = false;
+				simulation_input.kursor.store(pack_kursor(kursor_x, kursor_y, 0));
+				simulation_input.is_click.store(false);
+				simulation_input.is_running.store(true);
+				SDL_SetEventFilter(motion_event_filter, &simulation_input);
+				simulation = std::thread(simulation_thread, &simulation_input, &snapshots, world, snapshot);
+
+				shown_time = Uint32(-1); // счетчик времени нужно перерисовать
+				is_redraw = true;
+				if (is_dirty_rect)
+					static_scene.rebuild(scene);
+			}
+
 			while (is_start) // цикл для запуска игры из меню
 			{
+				Uint32 frame_start = SDL_GetTicks();
+
+				/* движения мыши сюда не доходят - их схлопывает motion_event_filter */
 				while (SDL_PollEvent(&event)) // цикл обработки событий с клавиатуры и комп. мышки
 				{
 					switch (event.type)
 					{
 					case SDL_QUIT:
 						is_running_game = false;
+						is_start = false;
 						break;
 
 					case SDL_WINDOWEVENT:
@@ -806,125 +3488,181 @@ int main(int argc, char* argv[])
 							window_width = event.window.data1;
 							window_height = event.window.data2;
 
+							if (assets.is_open()) // в пакете может быть фон, заранее отмасштабированный ровно под это окно
+								background_texture = background_object.create_texture("background.jpg", window_width, window_height);
 							background_object.set_dst(0, 0, window_width, window_height);
+							if (level_filename.empty()) // первая стенка встроенного лабиринта зависит от высоты окна
+								change_level(level_walls, builtin_level(window_height), scene, static_scene, &simulation_input);
+							if (is_dirty_rect)
+								static_scene.rebuild(scene);
+						}
+						else if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+						{
+							static_scene.invalidate();
 						}
-						break;
-
-					case SDL_MOUSEMOTION:
-						/* отслеживаем координаты комп. мыши и сохраняем */
-						kursor_x = event.motion.x;
-						kursor_y = event.motion.y;
 
-						if (mouse_x > kursor_x)
-							mirror = true;
-						else
-							mirror = false;
+						switch (event.window.event)
+						{
+						case SDL_WINDOWEVENT_MINIMIZED:
+						case SDL_WINDOWEVENT_HIDDEN:
+							is_window_visible = false;
+							break;
+
+						case SDL_WINDOWEVENT_RESTORED:
+						case SDL_WINDOWEVENT_MAXIMIZED:
+						case SDL_WINDOWEVENT_SHOWN:
+						case SDL_WINDOWEVENT_EXPOSED:
+							is_window_visible = true;
+							break;
+
+						case SDL_WINDOWEVENT_FOCUS_LOST:
+							is_window_focused = false;
+							break;
+
+						case SDL_WINDOWEVENT_FOCUS_GAINED:
+							is_window_focused = true;
+							break;
+						}
+						is_redraw = true;
 						break;
 
 					case SDL_MOUSEBUTTONDOWN:
 						if (event.button.button == SDL_BUTTON_LEFT)
 							is_mouse_button_click = true;
+						simulation_input.is_click.store(is_mouse_button_click);
+						simulation_input.wake_simulation();
 						break;
 
 					case SDL_MOUSEBUTTONUP:
 						if (event.button.button == SDL_BUTTON_LEFT)
 							is_mouse_button_click = false;
+						simulation_input.is_click.store(is_mouse_button_click);
 						break;
 					}
 				}
 
-				if (surface_font != nullptr)
+				std::vector<SDL_Rect> new_walls;
+				if (level_watcher.poll() && load_level(level_filename, new_walls)) // горячая перезагрузка уровня
+					change_level(level_walls, new_walls, scene, static_scene, &simulation_input);
+
+				snapshots.update(); // берем самый свежий снимок мира, не дожидаясь потока симуляции
+				const GameSnapshot& snapshot = snapshots.read_buffer();
+
+				if (!is_start || snapshot.state != STATE_PLAYING) // партия закончена - останавливаем симуляцию
 				{
-					SDL_FreeSurface(surface_font);
+					simulation_input.is_running.store(false);
+					SDL_SemPost(simulation_input.wakeup);
+					simulation.join();
+					if (simulation_input.recorder != nullptr)
+						recorder.end_round();
+					while (SDL_SemTryWait(simulation_input.wakeup) == 0) {} // сбрасываем лишние пробуждения
+					simulation_input.is_main_waiting.store(false);
+					simulation_input.level_diffs.clear();
+					SDL_SetEventFilter(NULL, NULL);
+
+					Uint32 input_time = 0;
+					unpack_kursor(simulation_input.kursor.load(), kursor_x, kursor_y, input_time);
+					latency.report();
+					fog.report();
+
+					is_start = false;
+					is_mouse_button_click = false;
+					mouse_x = window_width / 100;
+					mouse_y = window_height / 2;
+					mouse_left_right_object.set_dst(mouse_x, mouse_y, 75, 65);
 				}
 
-				if (texture_font != nullptr)
+				if (snapshot.state == STATE_DEAD)
 				{
-					SDL_DestroyTexture(texture_font);
+					deadly_screen(background_texture, background_object.src, background_object.dst, particles,
+						snapshot.mouse_x + mouse_left_right_object.dst.w / 2, snapshot.mouse_y + mouse_left_right_object.dst.h / 2);
+					continue;
 				}
 
+				/* текст счетчика меняется раз в секунду - только тогда и перерисовываем его шрифтом */
 				elapsed_time = (SDL_GetTicks() - start_time) / 1000;
-				sprintf_s(str, "Time %02i:%02i", elapsed_time / 60, elapsed_time % 60);
-
-				surface_font = TTF_RenderText_Blended(font, str, { 255, 255, 255, 255 });
-				texture_font = SDL_CreateTextureFromSurface(render, surface_font);
-				font_dst = { 0, 0, surface_font->w, surface_font->h };
-
-#pragma region drawing
-				SDL_RenderClear(render);
-
-				/* отрисовка заднего фона */
-				SDL_RenderCopy(render, background_texture, &background_object.src, &background_object.dst);
-
-				SDL_RenderCopy(render, texture_font, NULL, &font_dst);
-
-				counter = drawing_maze(wall_x, wall_y, wall_w, wall_h); // отрисовка стенок лабиринта
-
-				/* обработка движений мышки (персонажа) при нажатии левой кнопки мыши */
-				if (is_mouse_button_click)
+				if (elapsed_time != shown_time)
 				{
-					/* движение мыши за курсором */
-					len = move_mouse(mouse_x, mouse_y, kursor_x, kursor_y, FPS, speed);
-					mouse_left_right_object.dst.x = mouse_x;
-					mouse_left_right_object.dst.y = mouse_y;
-
-					if (len > 30) // оставляем расстояние от курсора, чтобы не прилипала к нему
+					if (surface_font != nullptr)
 					{
-						frame = (frame + 1) % count_frame;
-						mouse_left_right_object.src.x = frame * mouse_left_right_object.src.w;
+						SDL_FreeSurface(surface_font);
 					}
-					else
+
+					if (texture_font != nullptr)
 					{
-						mouse_left_right_object.src.x = mouse_left_right_object.src.w * 2;
+						SDL_DestroyTexture(texture_font);
 					}
-				}
-				/* проверка на столкновение со стенкой лабиринта */
-				if (check_collision_wall(mouse_x, mouse_y, mouse_left_right_object.dst.w,
-					mouse_left_right_object.dst.h, wall_x, wall_y, wall_w, wall_h, counter))
-				{
-					is_start = false;
-					mouse_x = window_width / 100;
-					mouse_y = window_height / 2;
-					is_mouse_button_click = false;
-					mouse_left_right_object.set_dst(mouse_x, mouse_y, 75, 65);
-					deadly_screen(background_texture, background_object.src, background_object.dst);
+
+					snprintf(str, sizeof(str), "Time %02i:%02i", elapsed_time / 60, elapsed_time % 60);
+
+					surface_font = TTF_RenderText_Blended(font, str, { 255, 255, 255, 255 });
+					texture_font = SDL_CreateTextureFromSurface(render, surface_font);
+					font_dst = { 0, 0, surface_font->w, surface_font->h };
+					shown_time = elapsed_time;
+					is_redraw = true;
 				}
 
-				/* проверка на столкновение с ключем (финиш) */
-				if (check_collisoin_key(mouse_x, mouse_y, mouse_left_right_object.dst.w,
-					mouse_left_right_object.dst.h, key_object.dst.x, key_object.dst.y))
+				if (snapshot.state == STATE_VICTORY)
 				{
-					is_start = false;
-					mouse_x = window_width / 100;
-					mouse_y = window_height / 2;
-					mouse_left_right_object.set_dst(mouse_x, mouse_y, 75, 65);
-					font_dst.x = 500;
-					font_dst.y = 350;
-					victory_screen(background_texture, background_object.src, background_object.dst, 
-						texture_font, font_dst);
+					SDL_Rect victory_font_dst = { 500, 350, font_dst.w, font_dst.h };
+					victory_screen(background_texture, background_object.src, background_object.dst,
+						texture_font, victory_font_dst, particles, key_object.dst.x + key_object.dst.w / 2,
+						key_object.dst.y + key_object.dst.h / 2);
+					continue;
 				}
 
-				/* отрисовка мышки */
-				if (!mirror)
-					SDL_RenderCopy(render, mouse_left_right_texture,
-						&mouse_left_right_object.src, &mouse_left_right_object.dst);
-				else
-					SDL_RenderCopyEx(render, mouse_left_right_texture,
-						&mouse_left_right_object.src, &mouse_left_right_object.dst, 0, NULL, SDL_FLIP_HORIZONTAL);
+				if (!is_start) // выход из игры во время партии
+					continue;
 
-				/* отрисовка ключа */
-				SDL_RenderCopy(render, key_texture, &key_object.src, &key_object.dst);
+				/* кадр выводится, только если окно видно и на экране что-то поменялось */
+				bool is_changed = is_redraw || !same_picture(snapshot, drawn_snapshot);
+				if (is_window_visible && is_changed)
+				{
+#pragma region drawing
+					scene.font = texture_font;
+					scene.font_dst = font_dst;
+					if (is_dirty_rect)
+						static_scene.draw_frame(scene, snapshot);
+					else
+						draw_game_frame(scene, snapshot);
 #pragma endregion drawing
 
-				SDL_RenderPresent(render); // обновление кадра после обработки событий и игровой логики 
-				SDL_Delay(1000 / FPS); // задержка для статического FPS
+					SDL_RenderPresent(render); // обновление кадра, логика при этом продолжает работать в своем потоке
+					latency.on_present(snapshot.input_time);
+					drawn_snapshot = snapshot;
+					is_redraw = false;
+				}
+
+				/* задержка до следующего кадра; в отличие от SDL_Delay, ожидание продолжает принимать события.
+				   Если мышка стоит, ждем до смены секунды на счетчике или до ввода (его шаг разбудит нас SDL_USEREVENT),
+				   в свернутом окне только обрабатываем события, а без фокуса рисуем с частотой idle_FPS */
+				Uint32 now = SDL_GetTicks();
+				Uint32 frame_time = now - frame_start;
+				Uint32 frame_delay = 1000 / (is_window_focused ? FPS : idle_FPS);
+				Uint32 wait = frame_delay > frame_time ? frame_delay - frame_time : 0;
+				bool is_idle = !is_window_visible || (!is_changed && !is_mouse_button_click);
+				if (!is_window_visible)
+					wait = 500;
+				else if (is_idle)
+					wait = std::max(wait, 1000 - (now - start_time) % 1000);
+
+				if (wait > 0)
+				{
+					simulation_input.is_main_waiting.store(is_idle && is_window_visible); // свернутое окно будить ради кадров незачем
+					// новый снимок мог появиться до того, как мы сообщили об ожидании (в свернутом окне он подождет)
+					if (!is_idle || !is_window_visible || !snapshots.update())
+						SDL_WaitEventTimeout(NULL, wait);
+					simulation_input.is_main_waiting.store(false);
+				}
 			}
 		}
 
+	SDL_DestroySemaphore(simulation_input.wakeup);
 	Mix_CloseAudio(); // закрытие потока фонового аудио
 	Mix_FreeMusic(music); // освобождаем память для музыки
 	SDL_FreeSurface(surface_font); // освобождение поверхности шрифта счетчика времени
 	SDL_DestroyTexture(fail_screen_texture); // удаление текстуры смерти с косой
 	Deinit_SDL2(background_texture, mouse_left_right_texture, key_texture, texture_font); // закрываем процессы
 	return 0;
-}
\ No newline at end of file
+}
+#endif // MOUSE_GAME_NO_MAIN
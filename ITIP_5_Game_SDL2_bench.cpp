@@ -0,0 +1,544 @@
+// бенчмарки горячих участков игры (сборка под Linux через CMakeLists.txt)
+// каждый результат выводится отдельной строкой JSON, чтобы результаты разных релизов можно было сравнивать diff'ом
+#define MOUSE_GAME_NO_MAIN
+#include "ITIP_5_Game_SDL2.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+
+FILE* bench_output = stdout; // куда выводятся результаты (по умолчанию stdout, либо файл из argv[1])
+volatile float bench_sink = 0; // не дает компилятору выбросить измеряемый код
+
+// подбираем число итераций так, чтобы замер длился не меньше 0.1 с, затем берем медиану из пяти замеров
+void run_benchmark(const char* name, int param, const std::function<void(long long)>& body)
+{
+	typedef std::chrono::steady_clock clock;
+
+	long long iterations = 1;
+	while (true)
+	{
+		clock::time_point start = clock::now();
+		body(iterations);
+		double seconds = std::chrono::duration<double>(clock::now() - start).count();
+		if (seconds >= 0.1)
+			break;
+		iterations *= seconds < 0.01 ? 10 : 2;
+	}
+
+	double samples[5];
+	for (double& sample : samples)
+	{
+		clock::time_point start = clock::now();
+		body(iterations);
+		sample = std::chrono::duration<double, std::nano>(clock::now() - start).count() / iterations;
+	}
+	std::sort(samples, samples + 5);
+
+	fprintf(bench_output, "{\"benchmark\":\"%s\",\"param\":%d,\"iterations\":%lld,\"ns_per_op\":%.1f,\"ns_min\":%.1f}\n",
+		name, param, iterations, samples[2], samples[0]);
+	fflush(bench_output);
+}
+
+void bench_move_mouse()
+{
+	run_benchmark("move_mouse", 0, [](long long iterations)
+		{
+			int mouse_x = 0;
+			int mouse_y = 0;
+			float sum = 0;
+			for (long long i = 0; i < iterations; ++i)
+			{
+				int kursor_x = 600 + int(i & 255); // курсор бегает, чтобы мышка не останавливалась
+				int kursor_y = 350 - int(i & 127);
+				sum += move_mouse(mouse_x, mouse_y, kursor_x, kursor_y, FPS, speed);
+			}
+			bench_sink = sum;
+		});
+}
+
+// случайные стенки толщиной 10 пикселей в прямоугольнике area
+std::vector<SDL_Rect> random_walls(int count, SDL_Rect area, unsigned seed)
+{
+	std::mt19937 random(seed);
+	std::vector<SDL_Rect> walls(count);
+	for (SDL_Rect& wall : walls)
+	{
+		bool is_horizontal = random() % 2 == 0;
+		wall.w = is_horizontal ? 20 + random() % 200 : 10;
+		wall.h = is_horizontal ? 10 : 20 + random() % 200;
+		wall.x = area.x + random() % (area.w - wall.w);
+		wall.y = area.y + random() % (area.h - wall.h);
+	}
+	return walls;
+}
+
+// лабиринт cols x rows клеток размером size (обход в глубину): стенки толщиной 6 пикселей между клетками
+std::vector<SDL_Rect> maze_walls(int cols, int rows, int size, unsigned seed)
+{
+	std::mt19937 random(seed);
+	std::vector<bool> is_right(cols * rows, true); // есть ли стенка справа от клетки и снизу
+	std::vector<bool> is_down(cols * rows, true);
+	std::vector<bool> is_seen(cols * rows, false);
+	std::vector<int> stack(1, 0);
+	is_seen[0] = true;
+	while (!stack.empty())
+	{
+		int cell = stack.back();
+		int x = cell % cols;
+		int y = cell / cols;
+		int next[4];
+		int count = 0;
+		if (x > 0 && !is_seen[cell - 1])
+			next[count++] = cell - 1;
+		if (x < cols - 1 && !is_seen[cell + 1])
+			next[count++] = cell + 1;
+		if (y > 0 && !is_seen[cell - cols])
+			next[count++] = cell - cols;
+		if (y < rows - 1 && !is_seen[cell + cols])
+			next[count++] = cell + cols;
+		if (count == 0)
+		{
+			stack.pop_back();
+			continue;
+		}
+
+		int to = next[random() % count];
+		if (to == cell + 1)
+			is_right[cell] = false;
+		else if (to == cell - 1)
+			is_right[to] = false;
+		else if (to == cell + cols)
+			is_down[cell] = false;
+		else
+			is_down[to] = false;
+		is_seen[to] = true;
+		stack.push_back(to);
+	}
+
+	std::vector<SDL_Rect> walls;
+	for (int y = 0; y < rows; ++y)
+	{
+		for (int x = 0; x < cols; ++x)
+		{
+			if (is_right[y * cols + x])
+				walls.push_back({ (x + 1) * size - 3, y * size, 6, size });
+			if (is_down[y * cols + x])
+				walls.push_back({ x * size, (y + 1) * size - 3, size, 6 });
+		}
+	}
+	return walls;
+}
+
+// проверка поля расстояний по точному расстоянию до прямоугольников на лабиринте (проходы в 20 клеток поля):
+// снаружи стенок ошибка не больше полутора клеток, внутри - значение не положительное с той же точностью,
+// а градиент смотрит от ближайшей точки стенки. Бенчмарк меряет поле, только если оно считает правильно
+bool check_distance_field(int cell_size)
+{
+	int size = std::max(30, 20 * cell_size);
+	std::vector<SDL_Rect> walls = maze_walls(1200 / size, 690 / size, size, 1);
+	DistanceField field;
+	field.bake(walls, cell_size);
+
+	std::mt19937 random(cell_size);
+	const float tolerance = 1.5f * cell_size + 0.01f;
+	for (int i = 0; i < 20000; ++i)
+	{
+		float x = float(random() % 1200) + 0.5f;
+		float y = float(random() % 690) + 0.5f;
+
+		float exact = 1e9f; // до ближайшей стенки (0 - внутри)
+		float nearest_x = x;
+		float nearest_y = y;
+		for (const SDL_Rect& wall : walls)
+		{
+			float px = std::max(float(wall.x), std::min(x, float(wall.x + wall.w)));
+			float py = std::max(float(wall.y), std::min(y, float(wall.y + wall.h)));
+			float d = sqrtf((x - px) * (x - px) + (y - py) * (y - py));
+			if (d < exact)
+			{
+				exact = d;
+				nearest_x = px;
+				nearest_y = py;
+			}
+		}
+
+		/* направление градиента однозначно, только если другие стенки заметно дальше ближайшей */
+		float other = 1e9f;
+		for (const SDL_Rect& wall : walls)
+		{
+			float px = std::max(float(wall.x), std::min(x, float(wall.x + wall.w)));
+			float py = std::max(float(wall.y), std::min(y, float(wall.y + wall.h)));
+			if (fabsf(px - nearest_x) + fabsf(py - nearest_y) > 2 * tolerance)
+				other = std::min(other, sqrtf((x - px) * (x - px) + (y - py) * (y - py)));
+		}
+
+		float value = field.get_distance(x, y);
+		bool is_ok = exact > 0 ? (exact > 60 || fabsf(value - exact) <= tolerance) : value <= tolerance;
+		if (is_ok && exact > 2 * tolerance && exact < 50 && other > exact + 4 * tolerance) // градиент снаружи: от стенки к точке
+		{
+			float gx = 0, gy = 0;
+			field.gradient(x, y, gx, gy);
+			float length = sqrtf(gx * gx + gy * gy);
+			is_ok = length > 0 && (gx * (x - nearest_x) + gy * (y - nearest_y)) / (length * exact) > 0.7f;
+		}
+		if (!is_ok)
+		{
+			std::cerr << "DistanceField check failed (cell " << cell_size << ") at " << x << ", " << y
+				<< ": exact " << exact << ", field " << value << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// стенки генерируются в правой части окна, а проверяемые точки - в левой,
+// поэтому столкновений нет и check_collision_wall каждый раз проходит по всем стенкам
+void bench_check_collision_wall(int count, const SpriteMasks& mouse_masks)
+{
+	std::mt19937 random(count);
+	std::vector<SDL_Rect> walls = random_walls(count, { 700, 0, window_width - 700, window_height }, count);
+	std::vector<int> wall_x(count), wall_y(count), wall_w(count), wall_h(count);
+	for (int i = 0; i < count; ++i)
+	{
+		wall_x[i] = walls[i].x;
+		wall_y[i] = walls[i].y;
+		wall_w[i] = walls[i].w;
+		wall_h[i] = walls[i].h;
+	}
+
+	int probe_x[256];
+	int probe_y[256];
+	for (int i = 0; i < 256; ++i)
+	{
+		probe_x[i] = random() % 500;
+		probe_y[i] = random() % (window_height - 65);
+	}
+
+	run_benchmark("check_collision_wall", count, [&](long long iterations)
+		{
+			int hits = 0;
+			for (long long i = 0; i < iterations; ++i)
+				hits += check_collision_wall(probe_x[i & 255], probe_y[i & 255], 75, 65,
+					wall_x.data(), wall_y.data(), wall_w.data(), wall_h.data(), count);
+			bench_sink = float(hits);
+		});
+
+	/* та же проверка через сетку WallIndex, которой пользуется поток симуляции */
+	WallIndex index;
+	index.assign(walls);
+	run_benchmark("wall_index_check_point", count, [&](long long iterations)
+		{
+			int hits = 0;
+			for (long long i = 0; i < iterations; ++i)
+				hits += index.check_point(probe_x[i & 255] + 37, probe_y[i & 255] + 32);
+			bench_sink = float(hits);
+		});
+
+	/* попиксельная проверка маской кадра мышки, как в simulation_step() */
+	run_benchmark("mask_collision", count, [&](long long iterations)
+		{
+			int hits = 0;
+			for (long long i = 0; i < iterations; ++i)
+				hits += check_collision_mask(index, *mouse_masks.get(int(i & 3), (i & 4) != 0),
+					probe_x[i & 255], probe_y[i & 255]);
+			bench_sink = float(hits);
+		});
+
+	/* запекание поля расстояний и проверка через него: точная проверка маской только рядом со стенками */
+	DistanceField field;
+	run_benchmark("distance_field_bake", count, [&](long long iterations)
+		{
+			for (long long i = 0; i < iterations; ++i)
+				field.bake(walls, sdf_cell_size);
+		});
+
+	run_benchmark("distance_field_query", count, [&](long long iterations)
+		{
+			float sum = 0;
+			for (long long i = 0; i < iterations; ++i)
+			{
+				float gx = 0, gy = 0;
+				field.gradient(probe_x[i & 255] + 37.0f, probe_y[i & 255] + 32.0f, gx, gy);
+				sum += field.get_distance(probe_x[i & 255] + 37.0f, probe_y[i & 255] + 32.0f) + gx + gy;
+			}
+			bench_sink = sum;
+		});
+
+	run_benchmark("distance_field_collision", count, [&](long long iterations)
+		{
+			int hits = 0;
+			for (long long i = 0; i < iterations; ++i)
+			{
+				int x = probe_x[i & 255];
+				int y = probe_y[i & 255];
+				if (field.touches_circle(x + 37.0f, y + 32.0f, 50.0f))
+					hits += check_collision_mask(index, *mouse_masks.get(int(i & 3), (i & 4) != 0), x, y);
+			}
+			bench_sink = float(hits);
+		});
+}
+
+// горячая перезагрузка большого уровня, в котором поменялись changed стенок: разница, правка геометрии,
+// сетки и поля расстояний. level_reload - мелкая правка (5 стенок), level_reload_bulk - пятая часть уровня
+void bench_level_reload(const char* name, int count, int changed)
+{
+	std::vector<SDL_Rect> walls_a = random_walls(count, { 0, 0, 4000, 4000 }, count);
+	std::vector<SDL_Rect> walls_b = walls_a;
+	for (int i = 0; i < changed; ++i)
+		walls_b[i * (count / changed)].x += 10;
+
+	std::vector<SDL_Rect> geometry = walls_a;
+	WallIndex index;
+	index.assign(walls_a);
+	DistanceField field;
+	field.bake(walls_a, sdf_cell_size);
+
+	run_benchmark(name, count, [&](long long iterations)
+		{
+			for (long long i = 0; i < iterations; ++i)
+			{
+				const std::vector<SDL_Rect>& next = (i % 2 == 0) ? walls_b : walls_a;
+				LevelDiff diff = diff_walls(geometry, next);
+				apply_diff(geometry, diff);
+				index.apply(diff);
+				field.update(index, diff, sdf_cell_size);
+			}
+			bench_sink = float(index.walls.size());
+		});
+}
+
+// отрисовка стенок тем же вызовом, что и в draw_game_frame(): встроенный лабиринт либо count случайных стенок
+void bench_draw_walls(int count)
+{
+	std::vector<SDL_Rect> walls = count > 0 ? random_walls(count, { 0, 0, window_width, window_height }, count)
+		: builtin_level(window_height);
+
+	run_benchmark("draw_walls", int(walls.size()), [&](long long iterations)
+		{
+			for (long long i = 0; i < iterations; ++i)
+			{
+				draw_walls(walls);
+				SDL_RenderFlush(render); // с пакетной отрисовкой иначе замерялось бы только накопление команд
+			}
+		});
+}
+
+// тот же путь, что проходит счетчик времени в каждом кадре main()
+void render_hud(TTF_Font* font, Uint32 elapsed_time, SDL_Texture*& texture_font, SDL_Rect& font_dst)
+{
+	char str[15];
+	snprintf(str, sizeof(str), "Time %02i:%02i", elapsed_time / 60, elapsed_time % 60);
+
+	SDL_Surface* surface_font = TTF_RenderText_Blended(font, str, { 255, 255, 255, 255 });
+	if (texture_font != nullptr)
+		SDL_DestroyTexture(texture_font);
+	texture_font = SDL_CreateTextureFromSurface(render, surface_font);
+	font_dst = { 0, 0, surface_font->w, surface_font->h };
+	SDL_FreeSurface(surface_font);
+}
+
+void bench_hud_text(TTF_Font* font)
+{
+	run_benchmark("hud_text", 0, [&](long long iterations)
+		{
+			SDL_Texture* texture_font = nullptr;
+			SDL_Rect font_dst;
+			for (long long i = 0; i < iterations; ++i)
+				render_hud(font, Uint32(i % 3600), texture_font, font_dst);
+			SDL_DestroyTexture(texture_font);
+		});
+}
+
+// вспышка частиц экрана смерти: шаг обновления пула и отрисовка всех частиц одним вызовом с SDL_RenderPresent
+void bench_particles(int count)
+{
+	ParticleSystem particles;
+	particles.create_sprite();
+
+	ParticleEmitter emitter = DEATH_EMITTER; // частицы не гаснут, чтобы их число не менялось во время замера
+	emitter.life_min = 1e9f;
+	emitter.life_max = 1e9f;
+	particles.emit(emitter, count, window_width / 2.0f, window_height / 2.0f);
+
+	run_benchmark("particles_update", count, [&](long long iterations)
+		{
+			for (long long i = 0; i < iterations; ++i)
+				particles.update(1.0f / FPS);
+			bench_sink = float(particles.size());
+		});
+
+	/* разлет на полсекунды без гравитации - частицы заполняют середину экрана */
+	particles.clear();
+	emitter.gravity = 0;
+	particles.emit(emitter, count, window_width / 2.0f, window_height / 2.0f);
+	particles.update(0.5f);
+	run_benchmark("particles_draw", count, [&](long long iterations)
+		{
+			for (long long i = 0; i < iterations; ++i)
+			{
+				SDL_RenderClear(render);
+				particles.draw();
+				SDL_RenderPresent(render);
+			}
+		});
+}
+
+// многоугольник видимости тумана войны из случайных клеток лабиринта 4000x2400 с клетками size пикселей
+void bench_visibility(int size)
+{
+	FogOfWar fog;
+	int cols = 4000 / size;
+	int rows = 2400 / size;
+	fog.walls.assign(maze_walls(cols, rows, size, size));
+
+	std::mt19937 random(size);
+	float probe_x[256];
+	float probe_y[256];
+	for (int i = 0; i < 256; ++i)
+	{
+		probe_x[i] = (random() % cols + 0.5f) * size;
+		probe_y[i] = (random() % rows + 0.5f) * size;
+	}
+
+	run_benchmark("visibility_polygon", int(fog.walls.walls.size()), [&](long long iterations)
+		{
+			for (long long i = 0; i < iterations; ++i)
+				fog.compute(probe_x[i & 255], probe_y[i & 255]);
+		});
+}
+
+// полный кадр игры: шаг логики, счетчик времени, отрисовка сцены и SDL_RenderPresent
+// (is_dirty - отрисовка через StaticScene, как с ключом --dirty-rect)
+void bench_full_frame(TTF_Font* font, bool is_dirty)
+{
+	ObjectTexture background_object;
+	background_object.create_texture("background.jpg");
+	background_object.set_dst(0, 0, window_width, window_height);
+
+	ObjectTexture mouse_left_right_object;
+	mouse_left_right_object.create_texture("mouse_running_left_right.png");
+	mouse_left_right_object.set_src(0, 0, mouse_left_right_object.src.h + 3, mouse_left_right_object.src.h);
+	mouse_left_right_object.set_dst(mouse_x, mouse_y, 75, 65);
+
+	ObjectTexture key_object;
+	key_object.create_texture("key.png");
+	key_object.set_dst(940, 265, 50, 50);
+
+	std::vector<SDL_Rect> level_walls = builtin_level(window_height);
+
+	SimulationWorld world;
+	world.walls.assign(level_walls);
+	world.frame_w = mouse_left_right_object.src.w;
+	world.key_x = key_object.dst.x;
+	world.key_y = key_object.dst.y;
+
+	GameScene scene;
+	scene.background = &background_object;
+	scene.mouse = &mouse_left_right_object;
+	scene.key = &key_object;
+	scene.walls = &level_walls;
+
+	StaticScene static_scene;
+	if (is_dirty)
+		static_scene.rebuild(scene);
+
+	run_benchmark(is_dirty ? "full_frame_dirty_rect" : "full_frame", window_width * window_height, [&](long long iterations)
+		{
+			GameSnapshot snapshot;
+			for (long long i = 0; i < iterations; ++i)
+			{
+				simulation_step(snapshot, world, mouse_x + 10, mouse_y, false);
+				render_hud(font, Uint32(i / FPS), scene.font, scene.font_dst);
+				if (is_dirty)
+					static_scene.draw_frame(scene, snapshot);
+				else
+					draw_game_frame(scene, snapshot);
+				SDL_RenderPresent(render);
+			}
+			SDL_DestroyTexture(scene.font);
+			scene.font = nullptr;
+		});
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+	{
+		bench_output = fopen(argv[1], "w");
+		if (bench_output == nullptr)
+		{
+			std::cerr << "Error open output file: " << argv[1] << std::endl;
+			return 1;
+		}
+	}
+	std::cout.rdbuf(std::cerr.rdbuf()); // отладочный вывод игры не должен смешиваться с результатами
+
+	/* окно без дисплея и программный рендер; переменная окружения SDL_VIDEODRIVER имеет приоритет.
+	   Если драйвер рендера задан явно, SDL отключает пакетную отрисовку, а игра рендер не выбирает
+	   и работает с ней, поэтому включаем ее обратно - иначе кадры меряются не в той конфигурации, что в игре */
+	SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+	SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+	SDL_SetHint(SDL_HINT_RENDER_BATCHING, "1");
+	Init_SDL2(SDL_INIT_VIDEO);
+
+	TTF_Font* font = TTF_OpenFont("ebrimabd.ttf", 32);
+	if (font == nullptr)
+	{
+		std::cerr << "Error open font: " << TTF_GetError() << std::endl;
+		return 1;
+	}
+
+	/* кадр спрайта берется из загруженной текстуры так же, как в main() игры; текстура нужна только на время загрузки масок */
+	SpriteMasks mouse_masks;
+	{
+		ObjectTexture mouse_left_right_object;
+		mouse_left_right_object.create_texture("mouse_running_left_right.png");
+		mouse_left_right_object.set_src(0, 0, mouse_left_right_object.src.h + 3, mouse_left_right_object.src.h);
+		mouse_left_right_object.set_dst(mouse_x, mouse_y, 75, 65);
+		if (!load_sprite_masks("mouse_running_left_right.png", mouse_left_right_object.src, count_frame,
+			mouse_left_right_object.dst.w, mouse_left_right_object.dst.h, mouse_masks))
+			return 1;
+	}
+
+	const int field_cells[] = { 2, 4, 7 };
+	for (int cell : field_cells)
+		if (!check_distance_field(cell))
+			return 1;
+
+	bench_move_mouse();
+
+	const int wall_counts[] = { 29, 50, 200, 1000, 5000 };
+	for (int count : wall_counts)
+		bench_check_collision_wall(count, mouse_masks);
+
+	const int level_sizes[] = { 1000, 10000 };
+	for (int count : level_sizes)
+		bench_level_reload("level_reload", count, 5);
+	const int bulk_sizes[] = { 1000, 20000 };
+	for (int count : bulk_sizes)
+		bench_level_reload("level_reload_bulk", count, count / 5);
+
+	const int drawn_walls[] = { 0, 1000 }; // 0 - встроенный лабиринт
+	for (int count : drawn_walls)
+		bench_draw_walls(count);
+	bench_hud_text(font);
+
+	const int maze_cells[] = { 60, 30, 20 };
+	for (int size : maze_cells)
+		bench_visibility(size);
+
+	const int particle_counts[] = { 10000, 50000 };
+	for (int count : particle_counts)
+		bench_particles(count);
+	bench_full_frame(font, false);
+	bench_full_frame(font, true);
+
+	TTF_CloseFont(font);
+	Deinit_SDL2(nullptr, nullptr, nullptr, nullptr);
+
+	if (bench_output != stdout)
+		fclose(bench_output);
+	return 0;
+}
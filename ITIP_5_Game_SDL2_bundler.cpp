@@ -0,0 +1,168 @@
+// офлайн-упаковщик ресурсов игры в один файл для AssetBundle (сборка под Linux через CMakeLists.txt)
+// картинки заранее декодируются в ARGB8888 - основной формат текстур программного рендера и рендеров SDL на видеокарте,
+// шрифты кладутся как есть. Для фона можно заказать копии, заранее растянутые под размеры окна
+// (так же, как игра растягивает его на все окно), - только под те размеры, что перечислены в командной строке.
+// Запуск из каталога с ресурсами: ITIP_5_Game_SDL2_bundler assets.pak [ШИРИНАxВЫСОТА ...]
+#define MOUSE_GAME_NO_MAIN
+#include "ITIP_5_Game_SDL2.cpp"
+
+#include <cstdio>
+
+const char* bundle_images[] = { "background.jpg", "button_start.png", "button_options.png", "button_exit.png",
+	"mouse_running_left_right.png", "key.png", "died.png", "victory_sheet.png" };
+const char* bundle_fonts[] = { "RAVIE.TTF", "ebrimabd.ttf" };
+const char* scaled_image = "background.jpg"; // растягивается на все окно, поэтому для него делаются копии под размеры окна
+
+struct PendingEntry // запись пакета вместе с данными, которые еще не записаны в файл
+{
+	BundleEntry entry;
+	std::vector<Uint8> data;
+};
+
+PendingEntry make_entry(const std::string& name, Uint32 type)
+{
+	PendingEntry pending;
+	memset(&pending.entry, 0, sizeof(pending.entry));
+	strncpy(pending.entry.name, name.c_str(), sizeof(pending.entry.name) - 1);
+	pending.entry.type = type;
+	return pending;
+}
+
+PendingEntry image_entry(const std::string& name, SDL_Surface* surface) // surface в формате ARGB8888
+{
+	PendingEntry pending = make_entry(name, BUNDLE_IMAGE);
+	pending.entry.format = SDL_PIXELFORMAT_ARGB8888;
+	pending.entry.width = surface->w;
+	pending.entry.height = surface->h;
+	pending.entry.pitch = surface->w * 4;
+	pending.data.resize(size_t(pending.entry.pitch) * surface->h);
+
+	SDL_LockSurface(surface);
+	for (int y = 0; y < surface->h; ++y)
+	{
+		const Uint32* row = (const Uint32*)((const Uint8*)surface->pixels + y * surface->pitch);
+		memcpy(&pending.data[size_t(y) * pending.entry.pitch], row, pending.entry.pitch);
+		for (int x = 0; x < surface->w; ++x)
+			if ((row[x] >> 24) != 0xFF)
+				pending.entry.flags |= BUNDLE_HAS_ALPHA;
+	}
+	SDL_UnlockSurface(surface);
+	return pending;
+}
+
+bool add_image(std::vector<PendingEntry>& entries, const char* filename, const std::vector<SDL_Point>& sizes)
+{
+	SDL_Surface* surface = load_surface(filename);
+	if (surface == nullptr)
+		return false;
+	entries.push_back(image_entry(filename, surface));
+
+	for (const SDL_Point& size : sizes) // копии под размеры окна с билинейной фильтрацией (пропорции не сохраняются)
+	{
+		SDL_Surface* scaled = SDL_CreateRGBSurfaceWithFormat(0, size.x, size.y, 32, SDL_PIXELFORMAT_ARGB8888);
+		if (scaled == nullptr || SDL_SoftStretchLinear(surface, NULL, scaled, NULL) != 0)
+		{
+			std::cerr << "Error scaling " << filename << ": " << SDL_GetError() << std::endl;
+			SDL_FreeSurface(scaled);
+			SDL_FreeSurface(surface);
+			return false;
+		}
+		entries.push_back(image_entry(std::string(filename) + "@" + std::to_string(size.x) + "x" + std::to_string(size.y), scaled));
+		SDL_FreeSurface(scaled);
+	}
+
+	SDL_FreeSurface(surface);
+	return true;
+}
+
+bool add_raw(std::vector<PendingEntry>& entries, const char* filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Error open " << filename << std::endl;
+		return false;
+	}
+
+	PendingEntry pending = make_entry(filename, BUNDLE_RAW);
+	pending.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	entries.push_back(pending);
+	return true;
+}
+
+bool write_bundle(const char* filename, std::vector<PendingEntry>& entries)
+{
+	const Uint64 ALIGN = 64; // начало каждой записи выровнено, чтобы пиксели можно было сразу отдавать в SDL_UpdateTexture
+
+	Uint64 offset = sizeof(BundleHeader) + sizeof(BundleEntry) * entries.size();
+	for (PendingEntry& pending : entries)
+	{
+		offset = (offset + ALIGN - 1) / ALIGN * ALIGN;
+		pending.entry.offset = offset;
+		pending.entry.size = pending.data.size();
+		offset += pending.data.size();
+	}
+
+	std::ofstream file(filename, std::ios::binary);
+	BundleHeader header;
+	memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+	header.version = 1;
+	header.count = Uint32(entries.size());
+	file.write((const char*)&header, sizeof(header));
+	for (const PendingEntry& pending : entries)
+		file.write((const char*)&pending.entry, sizeof(pending.entry));
+
+	for (const PendingEntry& pending : entries)
+	{
+		while (Uint64(file.tellp()) < pending.entry.offset)
+			file.put(0);
+		file.write((const char*)pending.data.data(), pending.data.size());
+	}
+	return bool(file);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " assets.pak [WIDTHxHEIGHT ...]" << std::endl;
+		return 1;
+	}
+
+	std::vector<SDL_Point> sizes; // размеры окна, под которые заранее масштабируется фон
+	for (int i = 2; i < argc; ++i)
+	{
+		SDL_Point size;
+		if (sscanf(argv[i], "%dx%d", &size.x, &size.y) != 2 || size.x <= 0 || size.y <= 0)
+		{
+			std::cerr << "Bad size: " << argv[i] << std::endl;
+			return 1;
+		}
+		sizes.push_back(size);
+	}
+
+	if (IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG) == 0)
+	{
+		std::cerr << "Error IMG_Init(): " << IMG_GetError() << std::endl;
+		return 1;
+	}
+
+	std::vector<PendingEntry> entries;
+	bool is_ok = true;
+	for (const char* image : bundle_images)
+		is_ok = is_ok && add_image(entries, image, strcmp(image, scaled_image) == 0 ? sizes : std::vector<SDL_Point>());
+	for (const char* font : bundle_fonts)
+		is_ok = is_ok && add_raw(entries, font);
+
+	if (!is_ok || !write_bundle(argv[1], entries))
+	{
+		std::cerr << "Error writing bundle " << argv[1] << std::endl;
+		IMG_Quit();
+		return 1;
+	}
+
+	for (const PendingEntry& pending : entries)
+		std::cout << pending.entry.name << ": " << pending.entry.size << " bytes" << std::endl;
+	IMG_Quit();
+	return 0;
+}